@@ -0,0 +1,185 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+// The on-disk format of test files, shared by main and verify.
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+
+// Page 0 of a test file holds 16 header entries. Each entry refers to the most
+// recently committed version of one of the 16 most recently added records, which
+// is at offset + index * record size. Page 0 is 4096 bytes whatever the page size
+// of the machine that wrote the file, and records follow it.
+struct header_entry { size_t offset, index, version, marker; };
+
+static const size_t header_page_size = 4096;
+
+static const size_t header_entry_count = 16;
+static const size_t header_entry_marker = std::numeric_limits<size_t>::max();
+
+// Entries can be spaced further apart than their size, e.g. one to a cache line,
+// sector or page, so that updating one does not rewrite its neighbours. Entries
+// that do not fit on page 0 continue past it, and the records follow them. The
+// spacing is recorded in the manifest as entry_stride.
+inline size_t header_region_size(size_t entry_stride)
+{
+    return header_entry_count * entry_stride > header_page_size ? header_entry_count * entry_stride : header_page_size;
+}
+
+// The A/B header layout keeps two copies of the header entries on page 0, one
+// at the start of the page and one half way through it. Every update writes all
+// of the entries to the slot that was not written last, with the next sequence
+// number and a checksum, so a torn header write can only damage the older copy.
+static const uint64_t header_slot_magic = 0x746f6c5362414268ull;
+
+struct header_slot {
+    uint64_t magic;
+    uint64_t sequence;
+    uint64_t checksum;
+    uint64_t reserved;
+    header_entry entries[header_entry_count];
+};
+
+inline size_t header_slot_offset(uint64_t sequence)
+{
+    return (sequence % 2) * (header_page_size / 2);
+}
+
+// 64-bit FNV-1a.
+inline uint64_t checksum(const void* data, size_t length, uint64_t hash = 0xcbf29ce484222325ull)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+inline uint64_t header_slot_checksum(const header_slot& slot)
+{
+    uint64_t hash = checksum(&slot.sequence, sizeof(slot.sequence));
+    return checksum(slot.entries, sizeof(slot.entries), hash);
+}
+
+inline bool header_slot_is_valid(const header_slot& slot)
+{
+    return slot.magic == header_slot_magic && slot.checksum == header_slot_checksum(slot);
+}
+
+// The radix header layout keeps an entry for every record ever added to the
+// file, rather than for the 16 newest. Page 0 holds the root: the offsets of
+// the index pages, each of which holds the entries of index_page_entry_count
+// consecutive records. Records are numbered from 0 in the order they were
+// added, so the entry of record r is entry r % index_page_entry_count of the
+// page at pages[r / index_page_entry_count]. An index page is placed at the end
+// of the file as the file is extended, ahead of the first records it covers,
+// and the root refers to it before any of its entries are written.
+static const uint64_t radix_root_magic = 0x746f6f5278646152ull;
+static const size_t index_page_size = 4096;
+static const size_t index_page_entry_count = index_page_size / sizeof(header_entry);
+static const size_t radix_root_capacity = (header_page_size - 2 * sizeof(uint64_t)) / sizeof(uint64_t);
+
+struct radix_root {
+    uint64_t magic;
+    uint64_t page_count;
+    uint64_t pages[radix_root_capacity];
+};
+
+// In WAL mode every transaction is appended to test-*.wal as a log record
+// holding the new header entry followed by the image of the data record, whose
+// length it gives. Log records are numbered from 1 and the log ends at the first
+// one that is missing or fails its checksum.
+static const uint64_t wal_record_magic = 0x64726f6365524c57ull;
+
+struct wal_record {
+    uint64_t magic;
+    uint64_t sequence;
+    uint64_t checksum;
+    uint64_t slot;
+    uint64_t length;
+    header_entry header;
+};
+
+inline size_t wal_record_size(size_t length)
+{
+    return sizeof(wal_record) + length;
+}
+
+inline uint64_t wal_record_checksum(const wal_record& record, const void* data)
+{
+    uint64_t hash = checksum(&record.sequence, sizeof(record.sequence));
+    hash = checksum(&record.slot, sizeof(record.slot), hash);
+    hash = checksum(&record.length, sizeof(record.length), hash);
+    hash = checksum(&record.header, sizeof(record.header), hash);
+    return checksum(data, record.length, hash);
+}
+
+// In shadow paging mode no record is ever overwritten while it is referenced.
+// Every version of a data record, and every version of the table of header
+// entries, is written to a free slot. A transaction commits when the root on
+// page 0 is updated to point at the new table. The root fits in one sector.
+static const uint64_t shadow_root_magic = 0x746f6f5257444853ull;
+
+struct shadow_table {
+    header_entry entries[header_entry_count];
+    uint64_t page_offsets[header_entry_count];
+};
+
+struct shadow_root {
+    uint64_t magic;
+    uint64_t sequence;
+    uint64_t table_offset;
+    uint64_t table_checksum;
+    uint64_t checksum;
+};
+
+inline uint64_t shadow_root_checksum(const shadow_root& root)
+{
+    return checksum(&root, offsetof(shadow_root, checksum));
+}
+
+inline bool shadow_root_is_valid(const shadow_root& root)
+{
+    return root.magic == shadow_root_magic && root.checksum == shadow_root_checksum(root);
+}
+
+// Files that belong to a test file share its name, with another extension.
+inline std::string companion_file_name(const std::string& file_name, const std::string& extension)
+{
+    const std::string suffix = ".dat";
+    if (file_name.size() >= suffix.size() && !file_name.compare(file_name.size() - suffix.size(), suffix.size(), suffix))
+        return file_name.substr(0, file_name.size() - suffix.size()) + extension;
+    return file_name + extension;
+}
+
+inline std::string wal_file_name(const std::string& file_name)
+{
+    return companion_file_name(file_name, ".wal");
+}
+
+// Every run writes test-*.manifest before it creates the test file, with a
+// name=value line for each of its seed, parameters, strategy and host.
+inline std::string manifest_file_name(const std::string& file_name)
+{
+    return companion_file_name(file_name, ".manifest");
+}
+
+// With a random commit order, each round of versions updates the header entries
+// in an order drawn from std::mt19937_64, seeded with the run's seed. The shuffle
+// is written out because std::shuffle differs between standard libraries, and
+// verify must be able to regenerate the order.
+inline void shuffle_entries(size_t* entries, size_t count, std::mt19937_64& random)
+{
+    for (size_t i = count; i > 1; --i) {
+        size_t j = random() % i;
+        size_t entry = entries[i - 1];
+        entries[i - 1] = entries[j];
+        entries[j] = entry;
+    }
+}
+
+#endif // FORMAT_H
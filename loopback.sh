@@ -0,0 +1,100 @@
+#!/bin/sh
+# Runs a command against a freshly made filesystem in a sparse image file, so
+# that benchmark results do not depend on the state and fragmentation of the
+# host's disk. Every "{}" in the command is replaced with a working directory
+# on the filesystem, which is unmounted and deleted when the command exits.
+#
+#   ./loopback.sh [-k] ext4|xfs|btrfs size command...
+#   ./loopback.sh xfs 2G ./main --working={} write fsync none
+#
+# As root the image is mounted through a loop device. Otherwise ext2/3/4
+# images are mounted with fuse2fs, which runs the filesystem in userspace and
+# so measures FUSE as much as ext4. -k keeps the image, e.g. for verify.
+
+set -e
+
+keep_image=
+if [ "$1" = "-k" ]; then
+    keep_image=1
+    shift
+fi
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 [-k] ext4|xfs|btrfs size command..." >&2
+    exit 1
+fi
+fs_type=$1
+size=$2
+shift 2
+
+fixture=$(mktemp -d "${TMPDIR:-/tmp}/loopback-$fs_type.XXXXXX")
+image=$fixture/image
+mount_point=$fixture/mnt
+mkdir "$mount_point"
+mounted=
+
+cleanup() {
+    if [ -n "$mounted" ]; then
+        if [ "$(id -u)" = 0 ]; then
+            umount "$mount_point"
+        else
+            fusermount -u "$mount_point"
+        fi
+    fi
+    if [ -n "$keep_image" ]; then
+        echo "Kept image $image" >&2
+    else
+        rm -rf "$fixture"
+    fi
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# The image is sparse, so its blocks are only allocated on the host as the
+# filesystem writes them. Lazy initialization is turned off so that no
+# background zeroing competes with the benchmark.
+truncate -s "$size" "$image"
+case $fs_type in
+ext2|ext3|ext4)
+    mkfs."$fs_type" -q -F -E lazy_itable_init=0,lazy_journal_init=0 "$image" ;;
+xfs)
+    mkfs.xfs -q -f "$image" ;;
+btrfs)
+    mkfs.btrfs -q -f "$image" ;;
+*)
+    echo "Unknown filesystem type $fs_type" >&2
+    exit 1 ;;
+esac
+
+if [ "$(id -u)" = 0 ]; then
+    mount -o loop "$image" "$mount_point"
+elif command -v fuse2fs >/dev/null && [ "${fs_type#ext}" != "$fs_type" ]; then
+    fuse2fs -o fakeroot "$image" "$mount_point"
+else
+    echo "Mounting $fs_type without root needs fuse2fs and an ext2/3/4 image" >&2
+    exit 1
+fi
+mounted=1
+
+working_directory=$mount_point/working
+mkdir -p "$working_directory"
+echo "Running on $fs_type image $image ($size) mounted at $mount_point" >&2
+
+# Replace every {} in the command with the working directory.
+for argument; do
+    shift
+    replaced=
+    while :; do
+        case $argument in
+        *{}*)
+            replaced=$replaced${argument%%\{\}*}$working_directory
+            argument=${argument#*\{\}} ;;
+        *)
+            break ;;
+        esac
+    done
+    set -- "$@" "$replaced$argument"
+done
+
+status=0
+"$@" || status=$?
+exit $status
@@ -1,51 +1,577 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <deque>
 #include <dirent.h>
+#include <exception>
 #include <fcntl.h>
+#include <functional>
+#include <getopt.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+#include <map>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <stdexcept>
 #include <string>
-#include <sys/errno.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
+#include <system_error>
 #include <thread>
+#include <tuple>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
 
+#include "format.h"
+#include "platform.h"
+
 void ensure(bool condition)
 {
     if (!condition)
         throw std::system_error(errno, std::system_category());
 }
 
+// Records latencies so that throughput can be compared
+// between strategies and transaction protocols.
+class LatencyStats {
+public:
+    void record(std::chrono::steady_clock::duration duration)
+    {
+        m_samples.push_back(std::chrono::duration<double, std::micro>(duration).count());
+    }
+
+    void merge(const LatencyStats& other)
+    {
+        m_samples.insert(m_samples.end(), other.m_samples.begin(), other.m_samples.end());
+    }
+
+    void clear()
+    {
+        m_samples.clear();
+    }
+
+    size_t count() const
+    {
+        return m_samples.size();
+    }
+
+    double totalSeconds() const
+    {
+        double total = 0;
+        for (double sample : m_samples)
+            total += sample;
+        return total / 1e6;
+    }
+
+    // Returns the latency in microseconds that the given fraction of samples do not exceed.
+    double percentile(double fraction) const
+    {
+        if (m_samples.empty())
+            return 0;
+        std::vector<double> sorted = m_samples;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[std::min(sorted.size() - 1, size_t(sorted.size() * fraction))];
+    }
+
+    void report(const char* name) const
+    {
+        if (m_samples.empty())
+            return;
+
+        double total = totalSeconds();
+        fprintf(stderr, "%s: %zu in %.3fs (%.1f/s), latency us: mean %.1f, p50 %.1f, p99 %.1f, max %.1f\n", name, count(),
+            total, count() / total, total * 1e6 / count(), percentile(0.5), percentile(0.99), percentile(1));
+    }
+
+private:
+    std::vector<double> m_samples;
+};
+
+// The foreground work of each transaction is broken down into phases so that,
+// for example, page faults taken while writing through a mapping can be told
+// apart from the cost of syncing.
+enum Phase { phase_extend, phase_data_write, phase_header_write, phase_sync, phase_count };
+static const char* const phase_names[phase_count] = { "Extend", "Data write", "Header write", "Sync" };
+
+// Page fault and page cache counters, sampled around each phase to show how
+// much I/O it causes. The dirty and writeback page counts are system-wide, so
+// their changes are only meaningful on an otherwise idle machine. Counters that
+// the platform does not provide stay at zero.
+struct IOCounters {
+    long long minor_faults = 0;
+    long long major_faults = 0;
+    long long write_bytes = 0;
+    long long cancelled_write_bytes = 0;
+    long long dirty_pages = 0;
+    long long writeback_pages = 0;
+
+    static IOCounters sample()
+    {
+        IOCounters counters;
+        struct rusage usage;
+        ensure(getrusage(RUSAGE_SELF, &usage) == 0);
+        counters.minor_faults = usage.ru_minflt;
+        counters.major_faults = usage.ru_majflt;
+
+        static const int io_fd = open("/proc/self/io", O_RDONLY);
+        static const int vmstat_fd = open("/proc/vmstat", O_RDONLY);
+        read_proc_value(io_fd, "write_bytes", counters.write_bytes);
+        read_proc_value(io_fd, "cancelled_write_bytes", counters.cancelled_write_bytes);
+        read_proc_value(vmstat_fd, "nr_dirty", counters.dirty_pages);
+        read_proc_value(vmstat_fd, "nr_writeback", counters.writeback_pages);
+        return counters;
+    }
+
+    void add(const IOCounters& delta)
+    {
+        add(delta, IOCounters());
+    }
+
+    void add(const IOCounters& after, const IOCounters& before)
+    {
+        minor_faults += after.minor_faults - before.minor_faults;
+        major_faults += after.major_faults - before.major_faults;
+        write_bytes += after.write_bytes - before.write_bytes;
+        cancelled_write_bytes += after.cancelled_write_bytes - before.cancelled_write_bytes;
+        dirty_pages += after.dirty_pages - before.dirty_pages;
+        writeback_pages += after.writeback_pages - before.writeback_pages;
+    }
+
+    void report(const char* name) const
+    {
+        fprintf(stderr, "%s: %lld minor faults, %lld major faults, %lld bytes written, %lld cancelled, %+lld dirty pages, %+lld writeback pages\n",
+            name, minor_faults, major_faults, write_bytes, cancelled_write_bytes, dirty_pages, writeback_pages);
+    }
+
+private:
+    // Reads "<key> <value>" or "<key>: <value>" from a file in /proc.
+    static void read_proc_value(int fd, const char* key, long long& value)
+    {
+        if (fd == -1)
+            return;
+
+        char buffer[8192];
+        ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+        if (length <= 0)
+            return;
+        buffer[length] = 0;
+
+        size_t key_length = strlen(key);
+        for (const char* line = buffer; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : nullptr) {
+            if (!strncmp(line, key, key_length) && (line[key_length] == ' ' || line[key_length] == ':')) {
+                value = strtoll(line + key_length + 1, nullptr, 10);
+                return;
+            }
+        }
+    }
+};
+
+// Returns the sysfs directory describing the block device that holds a
+// directory, or an empty string if it is not backed by a block device.
+std::string block_device_sysfs_path(const std::string& directory)
+{
+#ifdef __linux__
+    struct stat st;
+    if (stat(directory.c_str(), &st) || !major(st.st_dev))
+        return std::string();
+
+    std::string link = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+    char path[PATH_MAX];
+    if (!realpath(link.c_str(), path))
+        return std::string();
+    return path;
+#else
+    (void)directory;
+    return std::string();
+#endif
+}
+
+// The sizes that writes can be aligned to, from the memory page to the device's
+// physical sector, detected at startup since they vary between machines: arm64
+// kernels can use 16 KiB or 64 KiB pages and many NVMe drives have 4 KiB
+// physical sectors. Sector sizes that cannot be found are assumed to be 512.
+struct Geometry {
+    size_t page_size = 0;
+    size_t filesystem_block_size = 0;
+    size_t logical_sector_size = 512;
+    size_t physical_sector_size = 512;
+
+    static Geometry detect(const std::string& directory)
+    {
+        Geometry geometry;
+        long page_size = sysconf(_SC_PAGESIZE);
+        ensure(page_size > 0);
+        geometry.page_size = page_size;
+
+        struct statvfs st;
+        ensure(statvfs(directory.c_str(), &st) == 0);
+        geometry.filesystem_block_size = st.f_bsize;
+
+        std::string sysfs_path = block_device_sysfs_path(directory);
+        if (!sysfs_path.empty()) {
+            read_queue_value(sysfs_path, "logical_block_size", geometry.logical_sector_size);
+            read_queue_value(sysfs_path, "physical_block_size", geometry.physical_sector_size);
+        }
+        return geometry;
+    }
+
+    void report() const
+    {
+        fprintf(stderr, "Page size %zu, filesystem block size %zu, logical sector size %zu, physical sector size %zu.\n",
+            page_size, filesystem_block_size, logical_sector_size, physical_sector_size);
+    }
+
+private:
+    // Partitions share the queue directory of the disk that holds them.
+    static void read_queue_value(const std::string& sysfs_path, const char* name, size_t& value)
+    {
+        for (const char* queue : { "/queue/", "/../queue/" }) {
+            FILE* file = fopen((sysfs_path + queue + name).c_str(), "r");
+            if (!file)
+                continue;
+            unsigned long long number;
+            if (fscanf(file, "%llu", &number) == 1 && number)
+                value = number;
+            fclose(file);
+            return;
+        }
+    }
+};
+
+Geometry geometry;
+
+// Counts what reaches the block device holding the test file, and the
+// filesystem journal where its statistics are exposed, so that device writes
+// can be compared to the bytes the transactions asked to make durable. These
+// are device-wide counters, so anything else writing to the device is included.
+class DeviceStatistics {
+public:
+    struct Sample {
+        long long bytes_written = -1;
+        long long journal_transactions = -1;
+        long long journal_bytes = -1;
+    };
+
+    explicit DeviceStatistics(const std::string& directory)
+    {
+        std::string sysfs_path = block_device_sysfs_path(directory);
+        if (sysfs_path.empty())
+            return;
+        m_name = sysfs_path.substr(sysfs_path.find_last_of('/') + 1);
+        m_stat_path = sysfs_path + "/stat";
+        m_jbd2_path = "/proc/fs/jbd2/" + m_name + "-8/info";
+        m_xfs_path = "/sys/fs/xfs/" + m_name + "/stats/stats";
+    }
+
+    const std::string& name() const
+    {
+        return m_name;
+    }
+
+    Sample sample() const
+    {
+        Sample sample;
+        if (m_name.empty())
+            return sample;
+
+        // The seventh field of the stat file is the number of 512-byte sectors written.
+        long long fields[7];
+        if (read_numbers(m_stat_path, fields, 7))
+            sample.bytes_written = fields[6] * 512;
+
+        // ext4's journal reports "<n> transactions (<m> requested), each up to <b> blocks".
+        long long transactions;
+        if (read_numbers(m_jbd2_path, &transactions, 1))
+            sample.journal_transactions = transactions;
+
+        // XFS reports "log <writes> <512-byte blocks> ..." among its statistics.
+        FILE* file = fopen(m_xfs_path.c_str(), "r");
+        if (file) {
+            char line[256];
+            long long writes, blocks;
+            while (fgets(line, sizeof(line), file)) {
+                if (sscanf(line, "log %lld %lld", &writes, &blocks) == 2) {
+                    sample.journal_transactions = writes;
+                    sample.journal_bytes = blocks * 512;
+                }
+            }
+            fclose(file);
+        }
+        return sample;
+    }
+
+    void report(const Sample& start, const Sample& end, long long application_bytes, const char* name) const
+    {
+        if (end.bytes_written < 0) {
+            fprintf(stderr, "%s: device statistics are not available.\n", name);
+            return;
+        }
+
+        long long device_bytes = end.bytes_written - start.bytes_written;
+        fprintf(stderr, "%s: %s wrote %lld bytes for %lld application bytes, write amplification %.2f", name, m_name.c_str(),
+            device_bytes, application_bytes, application_bytes ? (double)device_bytes / application_bytes : 0.0);
+        if (end.journal_transactions >= 0)
+            fprintf(stderr, ", %lld journal transactions", end.journal_transactions - start.journal_transactions);
+        if (end.journal_bytes >= 0)
+            fprintf(stderr, ", %lld journal bytes", end.journal_bytes - start.journal_bytes);
+        fputc('\n', stderr);
+    }
+
+private:
+    // Reads the whitespace-separated numbers at the start of a file.
+    static bool read_numbers(const std::string& path, long long* values, size_t count)
+    {
+        FILE* file = fopen(path.c_str(), "r");
+        if (!file)
+            return false;
+        size_t scanned = 0;
+        while (scanned < count && fscanf(file, "%lld", &values[scanned]) == 1)
+            ++scanned;
+        fclose(file);
+        return scanned == count;
+    }
+
+    std::string m_name;
+    std::string m_stat_path;
+    std::string m_jbd2_path;
+    std::string m_xfs_path;
+};
+
+LatencyStats phase_latency[phase_count];
+IOCounters phase_counters[phase_count];
+std::mutex phase_mutex;
+bool io_counters_enabled = false;
+
+class ScopedPhase {
+public:
+    explicit ScopedPhase(Phase phase)
+        : m_phase(phase)
+    {
+        if (io_counters_enabled)
+            m_counters = IOCounters::sample();
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedPhase()
+    {
+        auto duration = std::chrono::steady_clock::now() - m_start;
+        IOCounters counters;
+        if (io_counters_enabled)
+            counters = IOCounters::sample();
+
+        // Phases can run on several writer threads at once.
+        std::lock_guard<std::mutex> lock(phase_mutex);
+        phase_latency[m_phase].record(duration);
+        if (io_counters_enabled)
+            phase_counters[m_phase].add(counters, m_counters);
+    }
+
+private:
+    Phase m_phase;
+    IOCounters m_counters;
+    std::chrono::steady_clock::time_point m_start;
+};
+
 class WriteStrategy;
 
 class SyncStrategy {
 public:
     virtual void sync(const WriteStrategy&) = 0;
+
+    // Whether the strategy orders writes issued before it against writes issued after it.
+    virtual bool isBarrier() const { return true; }
+
+    // Whether the strategy makes the device write its cache to the medium. Only
+    // EmulatedWriteStrategy asks, since a real device is flushed by the call itself.
+    virtual bool flushesDeviceCache() const { return isBarrier(); }
+
+    // The call that sync makes, which can depend on what the platform and filesystem support.
+    virtual const char* primitive() const = 0;
 };
 
-class WriteStrategy {
+bool contains_barrier(const std::vector<SyncStrategy*>& strategies)
+{
+    for (auto* st : strategies) {
+        if (st->isBarrier())
+            return true;
+    }
+    return false;
+}
+
+// One of the ranges written by WriteStrategy::writeBatch.
+struct WriteExtent {
+    off_t offset;
+    const void* data;
+    size_t length;
+};
+
+enum WriteFlags {
+    write_flag_none = 0,
+    // The extents must be durable when writeBatch returns.
+    write_flag_dsync = 1 << 0,
+    // Poll for completion rather than waiting for an interrupt.
+    write_flag_high_priority = 1 << 1,
+};
+
+// Keeps files that have already been allocated and written in a pool directory
+// and hands them out in place of new files, as databases recycle log segments.
+// Extending a test file within the size of its pool file then changes no
+// metadata. Files are zero-filled with real writes, rather than ftruncate, so
+// that their blocks are allocated, and go back to the pool when a run completes.
+// Each type of file, such as data files and write-ahead logs, has its own size
+// and is only recycled as the same type, told apart by the name's extension.
+class FilePool {
 public:
-    WriteStrategy(const std::string& directory, const std::string& file_name) : m_fd(-1), m_length(0)
+    explicit FilePool(const std::string& directory)
+        : m_directory(directory)
     {
-        std::string file_path = directory + "/" + file_name;
-        m_fd = ::open(file_path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (mkdir(m_directory.c_str(), 0777) && errno != EEXIST)
+            ensure(false);
+        m_fd = open(m_directory.c_str(), O_RDONLY);
         ensure(m_fd != -1);
+    }
 
+    // Sets how large pool files are made for files with the given extension.
+    void setFileSize(const std::string& extension, off_t file_size)
+    {
+        m_file_sizes[extension] = file_size;
+    }
+
+    // Moves a pool file to directory/file_name, creating one if the pool has
+    // none of its type, and returns an open descriptor along with its size.
+    int acquire(int directory_fd, const std::string& file_name, off_t& capacity)
+    {
+        std::string extension = extensionOf(file_name);
+        std::string pool_file_name = "new-" + std::to_string(getpid()) + extension;
+        bool reused = takeFile(pool_file_name, extension);
+
+        int fd = openat(m_fd, pool_file_name.c_str(), O_RDWR | O_CREAT, 0666);
+        ensure(fd != -1);
+
+        struct stat st;
+        ensure(fstat(fd, &st) == 0);
+        capacity = std::max<off_t>(st.st_size, m_file_sizes[extension]);
+        fprintf(stderr, "%s pool file %s (%lld bytes) for %s.\n", reused ? "Reusing" : "Creating", pool_file_name.c_str(),
+            (long long)capacity, file_name.c_str());
+
+        // Nothing from an earlier run may be mistaken for data written by this one.
+        std::vector<char> zeroes(1 << 20);
+        for (off_t offset = 0; offset < capacity;) {
+            ssize_t count = pwrite(fd, zeroes.data(), std::min<off_t>(zeroes.size(), capacity - offset), offset);
+            ensure(count > 0);
+            offset += count;
+        }
+        ensure(fsync(fd) == 0);
+
+        // Linking fails rather than replacing a file that already has the name.
+        ensure(linkat(m_fd, pool_file_name.c_str(), directory_fd, file_name.c_str(), 0) == 0);
+        ensure(unlinkat(m_fd, pool_file_name.c_str(), 0) == 0);
+        ensure(fsync(m_fd) == 0);
+        return fd;
+    }
+
+    void release(int directory_fd, const std::string& file_name, int fd)
+    {
+        // Pool files are named after their inode so that names never collide.
+        struct stat st;
+        ensure(fstat(fd, &st) == 0);
+        std::string pool_file_name = "pool-" + std::to_string((unsigned long long)st.st_ino) + extensionOf(file_name);
+        ensure(renameat(directory_fd, file_name.c_str(), m_fd, pool_file_name.c_str()) == 0);
+        ensure(fsync(m_fd) == 0);
+        ensure(fsync(directory_fd) == 0);
+        fprintf(stderr, "Returned %s to the pool as %s.\n", file_name.c_str(), pool_file_name.c_str());
+    }
+
+private:
+    static std::string extensionOf(const std::string& file_name)
+    {
+        size_t dot = file_name.rfind('.');
+        return dot == std::string::npos ? std::string() : file_name.substr(dot);
+    }
+
+    // Renames a file of the given type in the pool to name, returning false if
+    // there are none. Runs started by the experiment scheduler share the pool,
+    // so a file only belongs to the process whose rename of it succeeds.
+    bool takeFile(const std::string& name, const std::string& extension)
+    {
+        DIR* directory_handle = opendir(m_directory.c_str());
+        ensure(directory_handle);
+        bool taken = false;
+        while (struct dirent* entry = readdir(directory_handle)) {
+            if (strncmp(entry->d_name, "pool-", 5) || extensionOf(entry->d_name) != extension)
+                continue;
+            if (!renameat(m_fd, entry->d_name, m_fd, name.c_str())) {
+                taken = true;
+                break;
+            }
+            ensure(errno == ENOENT);
+        }
+        closedir(directory_handle);
+        return taken;
+    }
+
+    std::string m_directory;
+    std::map<std::string, off_t> m_file_sizes;
+    int m_fd;
+};
+
+std::unique_ptr<FilePool> file_pool;
+
+class WriteStrategy {
+public:
+    WriteStrategy(const std::string& directory, const std::string& file_name) : m_fd(-1), m_length(0), m_capacity(0), m_pooled(false), m_file_name(file_name)
+    {
         DIR* directory_handle = opendir(directory.c_str());
         ensure(directory_handle);
 
         m_parentFD = dirfd(directory_handle);
         ensure(m_parentFD != -1);
 
+        if (file_pool) {
+            m_fd = file_pool->acquire(m_parentFD, file_name, m_capacity);
+            m_pooled = true;
+        } else {
+            std::string file_path = directory + "/" + file_name;
+            m_fd = ::open(file_path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+        }
+        ensure(m_fd != -1);
+
         ensure(fsync(m_parentFD) == 0);
     }
 
     virtual ~WriteStrategy()
     {
+        // A file that cannot be returned stays in the working directory.
+        if (m_pooled) {
+            try {
+                file_pool->release(m_parentFD, m_file_name, m_fd);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Could not return %s to the pool: %s\n", m_file_name.c_str(), e.what());
+            }
+        }
         close(m_fd);
     }
 
@@ -66,12 +592,17 @@ public:
         return m_length;
     }
 
+    const std::string& fileName() const
+    {
+        return m_file_name;
+    }
+
     virtual void *buffer() const
     {
         return nullptr;
     }
 
-    void sync(const std::vector<SyncStrategy*>& strategies) const
+    virtual void sync(const std::vector<SyncStrategy*>& strategies) const
     {
         for (auto* st : strategies)
             st->sync(*this);
@@ -79,32 +610,137 @@ public:
 
     virtual void extend(off_t length)
     {
-        ensure(ftruncate(m_fd, length) == 0);
+        // A pool file already has blocks up to its capacity, so growing within it needs no metadata update.
+        if (length > m_capacity)
+            ensure(ftruncate(m_fd, length) == 0);
         m_length = length;
     }
 
-    virtual void write(off_t offset, void* data, size_t length) = 0;
+    virtual void write(off_t offset, const void* data, size_t length) = 0;
+
+    // Writes extents that have no ordering requirements between them. Strategies
+    // that can do so issue them with fewer system calls than separate writes.
+    virtual void writeBatch(const std::vector<WriteExtent>& extents, int flags)
+    {
+        for (const auto& extent : extents)
+            write(extent.offset, extent.data, extent.length);
+        if (flags & write_flag_dsync)
+            ensure(fsync(m_fd) == 0);
+    }
+
 protected:
     int m_fd;
     int m_parentFD;
     size_t m_length;
+    off_t m_capacity;
+    bool m_pooled;
+    std::string m_file_name;
 };
 
 class PWriteWriteStrategy : public WriteStrategy {
 public:
     static std::unique_ptr<WriteStrategy> create(const std::string& directory, const std::string& file_name)
     {
-        return std::unique_ptr<WriteStrategy>(new PWriteWriteStrategy(directory, file_name));
+        return std::unique_ptr<WriteStrategy>(new PWriteWriteStrategy(directory, file_name, write_flag_none));
+    }
+
+    // Makes every write durable by itself with RWF_DSYNC, rather than relying
+    // on a separate sync of the whole file.
+    static std::unique_ptr<WriteStrategy> createDSync(const std::string& directory, const std::string& file_name)
+    {
+        return std::unique_ptr<WriteStrategy>(new PWriteWriteStrategy(directory, file_name, write_flag_dsync));
+    }
+
+    // Requests polled completion of every write with RWF_HIPRI. The kernel only
+    // polls for direct I/O to devices with poll queues and otherwise ignores it.
+    static std::unique_ptr<WriteStrategy> createHighPriority(const std::string& directory, const std::string& file_name)
+    {
+        return std::unique_ptr<WriteStrategy>(new PWriteWriteStrategy(directory, file_name, write_flag_high_priority));
+    }
+
+    static std::unique_ptr<WriteStrategy> createDSyncHighPriority(const std::string& directory, const std::string& file_name)
+    {
+        return std::unique_ptr<WriteStrategy>(new PWriteWriteStrategy(directory, file_name, write_flag_dsync | write_flag_high_priority));
+    }
+
+    PWriteWriteStrategy(const std::string& directory, const std::string& file_name, int flags)
+        : WriteStrategy(directory, file_name)
+        , m_flags(flags)
+    {}
+
+    void write(off_t offset, const void* data, size_t length) override
+    {
+        if (!m_flags) {
+            ensure(pwrite(m_fd, data, length, offset) == (ssize_t)length);
+            return;
+        }
+
+        struct iovec vector = { const_cast<void*>(data), length };
+        if (!writeVectors(std::vector<struct iovec>(1, vector), offset, length, m_flags))
+            ensure(fsync(m_fd) == 0);
     }
 
-    using WriteStrategy::WriteStrategy;
+    // Runs of extents that follow on from one another are written with a single
+    // pwritev. Where pwritev2 supports RWF_DSYNC each call is made durable by
+    // itself, and otherwise the file is synced once the batch has been written.
+    void writeBatch(const std::vector<WriteExtent>& extents, int flags) override
+    {
+        flags |= m_flags;
+        bool needs_sync = false;
+        std::vector<struct iovec> vectors;
+        for (size_t i = 0; i < extents.size();) {
+            off_t offset = extents[i].offset;
+            size_t length = 0;
+            vectors.clear();
+            for (; i < extents.size() && extents[i].offset == offset + (off_t)length && vectors.size() < IOV_MAX; ++i) {
+                struct iovec vector = { const_cast<void*>(extents[i].data), extents[i].length };
+                vectors.push_back(vector);
+                length += extents[i].length;
+            }
+            if (!writeVectors(vectors, offset, length, flags))
+                needs_sync = true;
+        }
+        if (needs_sync)
+            ensure(fsync(m_fd) == 0);
+    }
 
-    void write(off_t offset, void* data, size_t length)
+private:
+    // Returns false if the caller must still sync to honour write_flag_dsync.
+    bool writeVectors(const std::vector<struct iovec>& vectors, off_t offset, size_t length, int flags)
     {
-        ensure(pwrite(m_fd, data, length, offset) == length);
+#ifdef RWF_DSYNC
+        int write_flags = 0;
+        if (flags & write_flag_dsync)
+            write_flags |= RWF_DSYNC;
+        if (flags & write_flag_high_priority)
+            write_flags |= RWF_HIPRI;
+        if (write_flags) {
+            ssize_t count = pwritev2(m_fd, vectors.data(), vectors.size(), offset, write_flags);
+            if (count != -1 || (errno != EOPNOTSUPP && errno != ENOSYS)) {
+                ensure(count == (ssize_t)length);
+                return true;
+            }
+        }
+#endif
+        ensure(pwritev(m_fd, vectors.data(), vectors.size(), offset) == (ssize_t)length);
+        return !(flags & write_flag_dsync);
     }
+
+    int m_flags;
+};
+
+// Options for how MMapWriteStrategy maps the file, so that the cost of page
+// faults can be moved out of the first write to each page.
+struct MMapOptions {
+    bool populate = false;
+    bool huge_pages = false;
+    int access_advice = MADV_NORMAL;
+    bool will_need = false;
+    bool populate_write = false;
 };
 
+MMapOptions mmap_options;
+
 class MMapWriteStrategy : public WriteStrategy {
 public:
     static std::unique_ptr<WriteStrategy> create(const std::string& directory, const std::string& file_name)
@@ -132,82 +768,1442 @@ public:
         remap(old_length, m_length);
     }
 
-    void write(off_t offset, void* data, size_t length) override
+    void write(off_t offset, const void* data, size_t length) override
     {
         assert(offset + length <= m_length);
         memcpy(static_cast<char*>(m_buffer) + offset, data, length);
     }
 
+    void writeBatch(const std::vector<WriteExtent>& extents, int flags) override
+    {
+        for (const auto& extent : extents)
+            write(extent.offset, extent.data, extent.length);
+        if (!(flags & write_flag_dsync))
+            return;
+
+        for (const auto& extent : extents) {
+            off_t start = extent.offset / geometry.page_size * geometry.page_size;
+            ensure(msync(static_cast<char*>(m_buffer) + start, extent.offset + extent.length - start, MS_SYNC) == 0);
+        }
+    }
+
 private:
+    // Growing the mapping with mremap keeps the page table entries of the pages
+    // already mapped, so only the newly extended tail faults and is advised.
+    // A new mapping faults on every page again, so all of them are advised;
+    // MAP_POPULATE always needs one, since it only applies to mmap.
     void remap(off_t old_length, off_t new_length)
     {
-        if (m_buffer && old_length)
-            ::munmap(m_buffer, old_length);
-        if (!new_length)
-            return;
-        m_buffer = mmap(nullptr, new_length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
-        if (m_buffer == (void*)MAP_FAILED) {
-            m_buffer = nullptr;
-            throw std::system_error(errno, std::system_category());
+        off_t advised_offset = 0;
+#ifdef MREMAP_MAYMOVE
+        if (m_buffer && old_length && new_length && !mmap_options.populate) {
+            void* buffer = mremap(m_buffer, old_length, new_length, MREMAP_MAYMOVE);
+            ensure(buffer != MAP_FAILED);
+            m_buffer = buffer;
+            advised_offset = old_length / geometry.page_size * geometry.page_size;
+        } else
+#endif
+        {
+            if (m_buffer && old_length)
+                ::munmap(m_buffer, old_length);
+            if (!new_length)
+                return;
+            int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+            if (mmap_options.populate)
+                flags |= MAP_POPULATE;
+#endif
+            m_buffer = mmap(nullptr, new_length, PROT_READ | PROT_WRITE, flags, m_fd, 0);
+            if (m_buffer == (void*)MAP_FAILED) {
+                m_buffer = nullptr;
+                throw std::system_error(errno, std::system_category());
+            }
         }
+
+#ifdef MADV_HUGEPAGE
+        if (mmap_options.huge_pages)
+            ensure(madvise(m_buffer, new_length, MADV_HUGEPAGE) == 0);
+#endif
+        if (mmap_options.access_advice != MADV_NORMAL)
+            ensure(madvise(m_buffer, new_length, mmap_options.access_advice) == 0);
+
+        if (new_length <= advised_offset)
+            return;
+        char* advised = static_cast<char*>(m_buffer) + advised_offset;
+        if (mmap_options.will_need)
+            ensure(madvise(advised, new_length - advised_offset, MADV_WILLNEED) == 0);
+#ifdef MADV_POPULATE_WRITE
+        if (mmap_options.populate_write)
+            ensure(madvise(advised, new_length - advised_offset, MADV_POPULATE_WRITE) == 0);
+#endif
     }
 
     void *m_buffer;
 };
 
-class NoopSyncStrategy : public SyncStrategy {
+// Publishes every change as a new file rather than modifying the test file: the
+// complete contents are written to a temporary file, which is synced and then
+// renamed over the test file. Include fsyncparent in the sync strategies to
+// make the rename itself durable.
+class ReplaceWriteStrategy : public WriteStrategy {
 public:
-    void sync(const WriteStrategy& writer) override
+    static std::unique_ptr<WriteStrategy> create(const std::string& directory, const std::string& file_name)
     {
+        return std::unique_ptr<WriteStrategy>(new ReplaceWriteStrategy(directory, file_name, false));
     }
-};
 
-class MSyncStrategy : public SyncStrategy {
-public:
-    void sync(const WriteStrategy& writer) override
+    // Swaps the temporary file with the test file using renameat2(RENAME_EXCHANGE)
+    // or renameatx_np(RENAME_SWAP), then unlinks the old contents.
+    static std::unique_ptr<WriteStrategy> createExchange(const std::string& directory, const std::string& file_name)
     {
-        void* buffer = writer.buffer();
-        if (!buffer)
-            return;
+        return std::unique_ptr<WriteStrategy>(new ReplaceWriteStrategy(directory, file_name, true));
+    }
 
-        size_t length = writer.length();
-        if (!length)
-            return;
+    ReplaceWriteStrategy(const std::string& directory, const std::string& file_name, bool exchange)
+        : WriteStrategy(directory, file_name)
+        , m_temporary_file_name(".tmp-" + file_name)
+        , m_exchange(exchange)
+    {}
 
-        ensure(msync(buffer, length, MS_SYNC) == 0);
+    void extend(off_t length) override
+    {
+        m_contents.resize(length);
+        m_length = length;
+        publish();
     }
-};
 
-class FSyncStrategy : public SyncStrategy {
-public:
-    void sync(const WriteStrategy& writer) override
+    void write(off_t offset, const void* data, size_t length) override
     {
-        ensure(fsync(writer.fileDescriptor()) == 0);
+        assert(offset + length <= m_length);
+        memcpy(m_contents.data() + offset, data, length);
+        publish();
     }
-};
 
-class FSyncParentStrategy : public SyncStrategy {
-public:
-    void sync(const WriteStrategy& writer) override
+    // All of the extents are published as a single new version of the file.
+    void writeBatch(const std::vector<WriteExtent>& extents, int flags) override
     {
-        ensure(fsync(writer.parentFileDescriptor()) == 0);
+        for (const auto& extent : extents) {
+            assert(extent.offset + extent.length <= m_length);
+            memcpy(m_contents.data() + extent.offset, extent.data, extent.length);
+        }
+        publish();
+        if (flags & write_flag_dsync)
+            ensure(fsync(m_parentFD) == 0);
     }
-};
 
+private:
+    void publish()
+    {
+        bool has_name = false;
+        int fd = createTemporaryFile(has_name);
+        size_t offset = 0;
+        while (offset < m_contents.size()) {
+            ssize_t count = pwrite(fd, m_contents.data() + offset, m_contents.size() - offset, offset);
+            ensure(count > 0);
+            offset += count;
+        }
+        ensure(fsync(fd) == 0);
+        if (!has_name)
+            linkTemporaryFile(fd);
+
+        if (m_exchange) {
+#if defined(__linux__) && defined(RENAME_EXCHANGE)
+            ensure(renameat2(m_parentFD, m_temporary_file_name.c_str(), m_parentFD, m_file_name.c_str(), RENAME_EXCHANGE) == 0);
+#elif defined(RENAME_SWAP)
+            ensure(renameatx_np(m_parentFD, m_temporary_file_name.c_str(), m_parentFD, m_file_name.c_str(), RENAME_SWAP) == 0);
+#else
+            errno = ENOTSUP;
+            ensure(false);
+#endif
+            ensure(unlinkat(m_parentFD, m_temporary_file_name.c_str(), 0) == 0);
+        } else
+            ensure(renameat(m_parentFD, m_temporary_file_name.c_str(), m_parentFD, m_file_name.c_str()) == 0);
 
-class FullFSyncStrategy : public SyncStrategy {
-public:
-    void sync(const WriteStrategy& writer) override
+        close(m_fd);
+        m_fd = fd;
+    }
+
+    // Where O_TMPFILE is supported the temporary file has no name until its
+    // contents are durable, so a crash never leaves a partial file behind.
+    int createTemporaryFile(bool& has_name)
     {
-        ensure(fcntl(writer.fileDescriptor(), F_FULLFSYNC) == 0);
+#ifdef O_TMPFILE
+        int fd = openat(m_parentFD, ".", O_TMPFILE | O_RDWR, 0666);
+        if (fd != -1)
+            return fd;
+        if (errno != EOPNOTSUPP && errno != EISDIR)
+            ensure(false);
+#endif
+        has_name = true;
+        int named_fd = openat(m_parentFD, m_temporary_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        ensure(named_fd != -1);
+        return named_fd;
     }
-};
 
-std::vector<SyncStrategy*> write_sync_strategies;
-std::vector<SyncStrategy*> extend_sync_strategies;
-std::function<std::unique_ptr<WriteStrategy> (std::string, std::string)> writer_factory;
+    void linkTemporaryFile(int fd)
+    {
+        std::string path = "/proc/self/fd/" + std::to_string(fd);
+        ensure(linkat(AT_FDCWD, path.c_str(), m_parentFD, m_temporary_file_name.c_str(), AT_SYMLINK_FOLLOW) == 0);
+    }
 
-std::string current_timestamp()
+    std::string m_temporary_file_name;
+    bool m_exchange;
+    std::vector<char> m_contents;
+};
+
+std::vector<std::string> split_list(const std::string& list_string)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list_string.size()) {
+        size_t end = std::min(list_string.find(',', start), list_string.size());
+        items.push_back(list_string.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
+
+// Stands in for a storage device so that strategies can be compared on device
+// profiles without owning the hardware. Writes take the profile's command
+// latency and land in the write cache. They only reach the backing files, which
+// play the part of the medium, when they are destaged at the media bandwidth:
+// by a flush, as FUA writes, or oldest first when the cache is full. Whatever a
+// volatile cache holds is lost when its file is closed, so a test file left by
+// a run shows what would have survived a power loss as the run ended. Commands
+// are serialized, as on a device with a single queue.
+class EmulatedDevice {
+public:
+    struct Profile {
+        std::string name;
+        size_t cache_size;
+        std::chrono::microseconds write_latency;
+        std::chrono::microseconds flush_latency;
+        double media_megabytes_per_second;
+        bool fua;
+        bool volatile_cache;
+    };
+
+    // Parses a profile name optionally followed by settings that override it,
+    // e.g. "sata-ssd,flush-us=500,cache=0".
+    static Profile profile_from_string(const std::string& profile_string)
+    {
+        static const Profile profiles[] = {
+            { "hdd", 64 << 20, std::chrono::microseconds(100), std::chrono::microseconds(8000), 150, false, true },
+            { "sata-ssd", 32 << 20, std::chrono::microseconds(50), std::chrono::microseconds(2000), 500, false, true },
+            { "nvme", 256 << 20, std::chrono::microseconds(15), std::chrono::microseconds(500), 3000, true, true },
+            // Power loss protection makes the cache durable, so flushes return at once.
+            { "nvme-plp", 256 << 20, std::chrono::microseconds(15), std::chrono::microseconds(0), 3000, true, false },
+        };
+
+        std::vector<std::string> items = split_list(profile_string);
+        const Profile* base = nullptr;
+        for (const auto& profile : profiles) {
+            if (items.front() == profile.name)
+                base = &profile;
+        }
+        if (!base)
+            throw std::domain_error("Unknown device profile");
+
+        Profile profile = *base;
+        for (size_t i = 1; i < items.size(); ++i) {
+            size_t equals = items[i].find('=');
+            if (equals == std::string::npos)
+                throw std::domain_error("Device settings are written as name=value");
+            std::string name = items[i].substr(0, equals);
+            unsigned long value = std::stoul(items[i].substr(equals + 1));
+            if (name == "cache")
+                profile.cache_size = value;
+            else if (name == "write-us")
+                profile.write_latency = std::chrono::microseconds(value);
+            else if (name == "flush-us")
+                profile.flush_latency = std::chrono::microseconds(value);
+            else if (name == "mbps" && value)
+                profile.media_megabytes_per_second = value;
+            else if (name == "fua")
+                profile.fua = value;
+            else if (name == "volatile")
+                profile.volatile_cache = value;
+            else
+                throw std::domain_error("Unknown or invalid device setting");
+            profile.name += "-" + items[i];
+        }
+        return profile;
+    }
+
+    explicit EmulatedDevice(const Profile& profile)
+        : m_profile(profile)
+        , m_cached_bytes(0)
+    {
+        resetCounts();
+    }
+
+    const Profile& profile() const
+    {
+        return m_profile;
+    }
+
+    void write(int fd, off_t offset, const void* data, size_t length, bool fua)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_writes;
+        wait(m_profile.write_latency);
+
+        // Without FUA the host makes the write durable with a flush, as the kernel does.
+        if (fua && !m_profile.fua) {
+            cache(fd, offset, data, length);
+            flushLocked();
+            return;
+        }
+        if (fua || length > m_profile.cache_size) {
+            ++m_fua_writes;
+            discardCached(fd, offset, length);
+            destage(fd, offset, data, length);
+            return;
+        }
+        while (m_cached_bytes + length > m_profile.cache_size)
+            destageOldest();
+        cache(fd, offset, data, length);
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        flushLocked();
+    }
+
+    // Called when a file is closed. Only a non-volatile cache still writes its contents.
+    void close(int fd)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_cache.begin(); it != m_cache.end();) {
+            if (it->fd != fd) {
+                ++it;
+                continue;
+            }
+            if (!m_profile.volatile_cache)
+                destage(it->fd, it->offset, it->data.data(), it->data.size());
+            else
+                m_lost_bytes += it->data.size();
+            m_cached_bytes -= it->data.size();
+            it = m_cache.erase(it);
+        }
+    }
+
+    void resetCounts()
+    {
+        m_writes = 0;
+        m_fua_writes = 0;
+        m_flushes = 0;
+        m_destaged_bytes = 0;
+        m_lost_bytes = 0;
+    }
+
+    void report() const
+    {
+        fprintf(stderr, "Emulated %s device: %zu writes (%zu destaged directly), %zu flushes, %lld bytes destaged, %lld bytes lost from the cache.\n",
+            m_profile.name.c_str(), m_writes, m_fua_writes, m_flushes, m_destaged_bytes, m_lost_bytes);
+    }
+
+private:
+    struct CachedWrite {
+        int fd;
+        off_t offset;
+        std::vector<char> data;
+    };
+
+    // Sleeps through most of the time and spins for the rest, since a sleep can overshoot by tens of microseconds.
+    static void wait(std::chrono::steady_clock::duration duration)
+    {
+        auto deadline = std::chrono::steady_clock::now() + duration;
+        if (duration > std::chrono::microseconds(200))
+            std::this_thread::sleep_for(duration - std::chrono::microseconds(100));
+        while (std::chrono::steady_clock::now() < deadline)
+            ;
+    }
+
+    void cache(int fd, off_t offset, const void* data, size_t length)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        m_cache.push_back({ fd, offset, std::vector<char>(bytes, bytes + length) });
+        m_cached_bytes += length;
+    }
+
+    // Drops the cached bytes that a write going straight to the medium replaces,
+    // so that destaging them later cannot put the older data back.
+    void discardCached(int fd, off_t offset, size_t length)
+    {
+        off_t end = offset + length;
+        for (auto it = m_cache.begin(); it != m_cache.end();) {
+            off_t cached_end = it->offset + it->data.size();
+            if (it->fd != fd || cached_end <= offset || it->offset >= end) {
+                ++it;
+                continue;
+            }
+
+            CachedWrite overlapping = std::move(*it);
+            it = m_cache.erase(it);
+            m_cached_bytes -= overlapping.data.size();
+            if (cached_end > end) {
+                it = m_cache.insert(it, { fd, end, std::vector<char>(overlapping.data.end() - (cached_end - end), overlapping.data.end()) });
+                m_cached_bytes += it->data.size();
+            }
+            if (overlapping.offset < offset) {
+                it = m_cache.insert(it, { fd, overlapping.offset, std::vector<char>(overlapping.data.begin(), overlapping.data.begin() + (offset - overlapping.offset)) });
+                m_cached_bytes += it->data.size();
+                ++it;
+            }
+            if (cached_end > end)
+                ++it;
+        }
+    }
+
+    void flushLocked()
+    {
+        ++m_flushes;
+        if (!m_profile.volatile_cache)
+            return;
+        wait(m_profile.flush_latency);
+        while (!m_cache.empty())
+            destageOldest();
+    }
+
+    void destageOldest()
+    {
+        CachedWrite& write = m_cache.front();
+        destage(write.fd, write.offset, write.data.data(), write.data.size());
+        m_cached_bytes -= write.data.size();
+        m_cache.pop_front();
+    }
+
+    void destage(int fd, off_t offset, const void* data, size_t length)
+    {
+        wait(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(length / (m_profile.media_megabytes_per_second * 1e6))));
+        ensure(pwrite(fd, data, length, offset) == (ssize_t)length);
+        m_destaged_bytes += length;
+    }
+
+    Profile m_profile;
+    std::mutex m_mutex;
+    std::deque<CachedWrite> m_cache;
+    size_t m_cached_bytes;
+    size_t m_writes;
+    size_t m_fua_writes;
+    size_t m_flushes;
+    long long m_destaged_bytes;
+    long long m_lost_bytes;
+};
+
+std::unique_ptr<EmulatedDevice> emulated_device;
+
+// Writes through the emulated device. Each sync strategy in a list that would
+// flush a real device's cache flushes the emulated one instead, so the host's
+// own storage is never synced.
+class EmulatedWriteStrategy : public WriteStrategy {
+public:
+    static std::unique_ptr<WriteStrategy> create(const std::string& directory, const std::string& file_name)
+    {
+        return std::unique_ptr<WriteStrategy>(new EmulatedWriteStrategy(directory, file_name, write_flag_none));
+    }
+
+    // Makes every write durable by itself, as write-dsync does, which the
+    // device does with FUA if its profile supports it.
+    static std::unique_ptr<WriteStrategy> createDSync(const std::string& directory, const std::string& file_name)
+    {
+        return std::unique_ptr<WriteStrategy>(new EmulatedWriteStrategy(directory, file_name, write_flag_dsync));
+    }
+
+    EmulatedWriteStrategy(const std::string& directory, const std::string& file_name, int flags)
+        : WriteStrategy(directory, file_name)
+        , m_flags(flags)
+    {}
+
+    ~EmulatedWriteStrategy() { emulated_device->close(m_fd); }
+
+    void write(off_t offset, const void* data, size_t length) override
+    {
+        emulated_device->write(m_fd, offset, data, length, m_flags & write_flag_dsync);
+    }
+
+    void writeBatch(const std::vector<WriteExtent>& extents, int flags) override
+    {
+        flags |= m_flags;
+        for (const auto& extent : extents)
+            emulated_device->write(m_fd, extent.offset, extent.data, extent.length, flags & write_flag_dsync);
+    }
+
+    void sync(const std::vector<SyncStrategy*>& strategies) const override
+    {
+        for (auto* st : strategies) {
+            if (st->flushesDeviceCache())
+                emulated_device->flush();
+        }
+    }
+
+private:
+    int m_flags;
+};
+
+class NoopSyncStrategy : public SyncStrategy {
+public:
+    void sync(const WriteStrategy& writer) override
+    {
+    }
+
+    bool isBarrier() const override { return false; }
+    const char* primitive() const override { return "none"; }
+};
+
+class MSyncStrategy : public SyncStrategy {
+public:
+    void sync(const WriteStrategy& writer) override
+    {
+        void* buffer = writer.buffer();
+        if (!buffer)
+            return;
+
+        size_t length = writer.length();
+        if (!length)
+            return;
+
+        ensure(msync(buffer, length, MS_SYNC) == 0);
+    }
+
+    bool flushesDeviceCache() const override { return false; }
+
+    const char* primitive() const override { return "msync(MS_SYNC)"; }
+};
+
+class FSyncStrategy : public SyncStrategy {
+public:
+    void sync(const WriteStrategy& writer) override
+    {
+        ensure(fsync(writer.fileDescriptor()) == 0);
+    }
+
+    const char* primitive() const override { return "fsync"; }
+};
+
+// Flushes the file's data, and only the metadata needed to read it back, so it
+// skips the inode update that fsync makes when the file size has not changed.
+class FDataSyncStrategy : public SyncStrategy {
+public:
+    void sync(const WriteStrategy& writer) override
+    {
+#ifdef __linux__
+        ensure(fdatasync(writer.fileDescriptor()) == 0);
+#else
+        ensure(fsync(writer.fileDescriptor()) == 0);
+#endif
+    }
+
+#ifdef __linux__
+    const char* primitive() const override { return "fdatasync"; }
+#else
+    const char* primitive() const override { return "fsync"; }
+#endif
+};
+
+// Writes back the file's dirty pages and waits for them, without flushing any
+// metadata or the device's write cache. It is not a durability guarantee, but
+// shows what the page cache writeback alone costs.
+class SyncFileRangeStrategy : public SyncStrategy {
+public:
+#ifdef SYNC_FILE_RANGE_WRITE
+    SyncFileRangeStrategy() : m_supported(true) {}
+#else
+    SyncFileRangeStrategy() : m_supported(false) {}
+#endif
+
+    void sync(const WriteStrategy& writer) override
+    {
+#ifdef SYNC_FILE_RANGE_WRITE
+        if (m_supported) {
+            if (!sync_file_range(writer.fileDescriptor(), 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER))
+                return;
+            if (errno != ENOSYS)
+                ensure(false);
+            m_supported = false;
+        }
+#endif
+        FDataSyncStrategy().sync(writer);
+    }
+
+    bool flushesDeviceCache() const override { return !m_supported; }
+
+    const char* primitive() const override
+    {
+        return m_supported ? "sync_file_range" : FDataSyncStrategy().primitive();
+    }
+
+private:
+    std::atomic<bool> m_supported;
+};
+
+// Flushes the whole filesystem holding the file, as a coarse alternative to
+// syncing the file and its parent directory separately.
+class SyncFSStrategy : public SyncStrategy {
+public:
+    void sync(const WriteStrategy& writer) override
+    {
+#ifdef __linux__
+        ensure(syncfs(writer.fileDescriptor()) == 0);
+#else
+        sync();
+#endif
+    }
+
+#ifdef __linux__
+    const char* primitive() const override { return "syncfs"; }
+#else
+    const char* primitive() const override { return "sync"; }
+#endif
+};
+
+class FSyncParentStrategy : public SyncStrategy {
+public:
+    void sync(const WriteStrategy& writer) override
+    {
+        ensure(fsync(writer.parentFileDescriptor()) == 0);
+    }
+
+    const char* primitive() const override { return "fsync(parent)"; }
+};
+
+// Asks the drive to write its cache to permanent storage with F_FULLFSYNC. Where
+// that is not available the strongest local equivalent is fsync, which on Linux
+// already flushes the device's volatile write cache on filesystems that use
+// write barriers.
+class FullFSyncStrategy : public SyncStrategy {
+public:
+#ifdef F_FULLFSYNC
+    FullFSyncStrategy() : m_supported(true) {}
+#else
+    FullFSyncStrategy() : m_supported(false) {}
+#endif
+
+    void sync(const WriteStrategy& writer) override
+    {
+#ifdef F_FULLFSYNC
+        if (m_supported) {
+            if (fcntl(writer.fileDescriptor(), F_FULLFSYNC) != -1)
+                return;
+            // Some filesystems, such as network filesystems, do not support it.
+            if (errno != ENOTSUP && errno != EINVAL)
+                ensure(false);
+            m_supported = false;
+        }
+#endif
+        ensure(fsync(writer.fileDescriptor()) == 0);
+    }
+
+    const char* primitive() const override
+    {
+        return m_supported ? "fcntl(F_FULLFSYNC)" : "fsync";
+    }
+
+private:
+    std::atomic<bool> m_supported;
+};
+
+// Lets one sync of a file stand in for the syncs that several threads ask for
+// at once. The first thread to ask leads a round and calls the wrapped
+// strategy. Threads that ask while a round is in progress wait for it, then
+// for the next round, which the first of them leads, since the round in
+// progress may have started before their writes. Every thread waiting when a
+// round completes is released together.
+class CoalescingSyncStrategy : public SyncStrategy {
+public:
+    explicit CoalescingSyncStrategy(SyncStrategy* strategy)
+        : m_strategy(strategy)
+        , m_requests(0)
+        , m_rounds(0)
+    {}
+
+    void sync(const WriteStrategy& writer) override
+    {
+        ++m_requests;
+        File& file = fileFor(writer.fileDescriptor());
+        std::unique_lock<std::mutex> lock(file.mutex);
+        uint64_t round_needed = file.started + 1;
+        while (file.completed < round_needed) {
+            if (file.in_progress) {
+                file.round_completed.wait(lock);
+                continue;
+            }
+
+            file.in_progress = true;
+            uint64_t round = ++file.started;
+            lock.unlock();
+            ++m_rounds;
+            try {
+                m_strategy->sync(writer);
+            } catch (...) {
+                lock.lock();
+                file.in_progress = false;
+                file.round_completed.notify_all();
+                throw;
+            }
+            lock.lock();
+            file.in_progress = false;
+            file.completed = round;
+            file.round_completed.notify_all();
+        }
+    }
+
+    bool isBarrier() const override { return m_strategy->isBarrier(); }
+    bool flushesDeviceCache() const override { return m_strategy->flushesDeviceCache(); }
+    const char* primitive() const override { return m_strategy->primitive(); }
+
+    void report(size_t commit_count) const
+    {
+        unsigned long long requests = m_requests, rounds = m_rounds;
+        fprintf(stderr, "Coalesced %s: %llu requested, %llu issued, %llu saved (%.2f per commit)\n", m_strategy->primitive(),
+            requests, rounds, requests - rounds, commit_count ? double(requests - rounds) / commit_count : 0.0);
+    }
+
+    void resetCounts()
+    {
+        m_requests = 0;
+        m_rounds = 0;
+    }
+
+private:
+    struct File {
+        std::mutex mutex;
+        std::condition_variable round_completed;
+        uint64_t started = 0;
+        uint64_t completed = 0;
+        bool in_progress = false;
+    };
+
+    File& fileFor(int fd)
+    {
+        std::lock_guard<std::mutex> lock(m_files_mutex);
+        std::unique_ptr<File>& file = m_files[fd];
+        if (!file)
+            file.reset(new File);
+        return *file;
+    }
+
+    SyncStrategy* m_strategy;
+    std::atomic<unsigned long long> m_requests;
+    std::atomic<unsigned long long> m_rounds;
+    std::mutex m_files_mutex;
+    std::unordered_map<int, std::unique_ptr<File>> m_files;
+};
+
+std::vector<CoalescingSyncStrategy*> coalescing_sync_strategies;
+
+// Copies a file to snapshot-<file name> next to it, as a backup would, using a
+// reflink where the filesystem supports one.
+class Snapshotter {
+public:
+    enum Method { Auto, Clone, CopyRange, Stream };
+
+    explicit Snapshotter(Method method) : m_method(method) {}
+
+    // Returns the name of the method that was used.
+    const char* snapshot(const WriteStrategy& writer)
+    {
+        // The previous snapshot is only replaced once the new one is complete.
+        std::string snapshot_name = "snapshot-" + writer.fileName();
+        std::string name = ".tmp-" + snapshot_name;
+        int directory = writer.parentFileDescriptor();
+        int source = writer.fileDescriptor();
+        ensure(unlinkat(directory, name.c_str(), 0) == 0 || errno == ENOENT);
+
+        struct stat st;
+        ensure(fstat(source, &st) == 0);
+
+        const char* method = nullptr;
+        int destination = -1;
+#ifdef __APPLE__
+        if ((m_method == Auto || m_method == Clone) && !fclonefileat(source, directory, name.c_str(), 0)) {
+            destination = openat(directory, name.c_str(), O_RDWR);
+            ensure(destination != -1);
+            method = "clone";
+        }
+#endif
+        if (destination == -1) {
+            destination = openat(directory, name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+            ensure(destination != -1);
+        }
+        // A failed snapshot leaves no temporary file behind.
+        try {
+#if defined(__linux__) && defined(FICLONE)
+            if (!method && (m_method == Auto || m_method == Clone) && !ioctl(destination, FICLONE, source))
+                method = "clone";
+#endif
+            if (!method && m_method == Clone)
+                ensure(false);
+#ifdef __linux__
+            if (!method && (m_method == Auto || m_method == CopyRange) && copyRange(source, destination, st.st_size))
+                method = "copy-range";
+#endif
+            if (!method && m_method == CopyRange)
+                ensure(false);
+            if (!method) {
+                stream(source, destination, st.st_size);
+                method = "stream";
+            }
+            ensure(fsync(destination) == 0);
+        } catch (...) {
+            close(destination);
+            unlinkat(directory, name.c_str(), 0);
+            throw;
+        }
+        close(destination);
+        ensure(renameat(directory, name.c_str(), directory, snapshot_name.c_str()) == 0);
+        ensure(fsync(directory) == 0);
+        return method;
+    }
+
+    // Checks that the filesystem holding directory supports the chosen method,
+    // so that a run fails before its first transaction rather than at its
+    // first snapshot. The other methods always work.
+    void probe(const std::string& directory)
+    {
+        if (m_method != Clone && m_method != CopyRange)
+            return;
+
+        int directory_fd = open(directory.c_str(), O_RDONLY);
+        ensure(directory_fd != -1);
+        std::string source_name = ".probe-source-" + std::to_string(getpid());
+        std::string destination_name = ".probe-destination-" + std::to_string(getpid());
+        int source = openat(directory_fd, source_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        ensure(source != -1);
+        std::vector<char> page(4096);
+        ensure(pwrite(source, page.data(), page.size(), 0) == (ssize_t)page.size());
+
+        bool supported = false;
+#ifdef __APPLE__
+        if (m_method == Clone)
+            supported = !fclonefileat(source, directory_fd, destination_name.c_str(), 0);
+#endif
+#ifdef __linux__
+        int destination = openat(directory_fd, destination_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        ensure(destination != -1);
+#ifdef FICLONE
+        if (m_method == Clone)
+            supported = !ioctl(destination, FICLONE, source);
+#endif
+        if (m_method == CopyRange)
+            supported = copyRange(source, destination, page.size());
+        close(destination);
+#endif
+        close(source);
+        unlinkat(directory_fd, source_name.c_str(), 0);
+        unlinkat(directory_fd, destination_name.c_str(), 0);
+        close(directory_fd);
+        if (!supported)
+            throw std::domain_error(std::string("The filesystem holding ") + directory + " cannot " + (m_method == Clone ? "clone files" : "copy ranges between files"));
+    }
+
+private:
+#ifdef __linux__
+    // Returns false if the kernel or filesystem cannot copy between these files.
+    bool copyRange(int source, int destination, off_t length)
+    {
+        loff_t source_offset = 0;
+        loff_t destination_offset = 0;
+        while (source_offset < length) {
+            ssize_t count = copy_file_range(source, &source_offset, destination, &destination_offset, length - source_offset, 0);
+            if (count == -1 && !source_offset && (errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOSYS))
+                return false;
+            ensure(count != -1);
+            if (!count)
+                throw std::runtime_error("Snapshot source ended before its length was copied");
+        }
+        return true;
+    }
+#endif
+
+    void stream(int source, int destination, off_t length)
+    {
+        std::vector<char> buffer(1 << 20);
+        for (off_t offset = 0; offset < length;) {
+            ssize_t count = pread(source, buffer.data(), std::min<off_t>(buffer.size(), length - offset), offset);
+            ensure(count != -1);
+            if (!count)
+                throw std::runtime_error("Snapshot source ended before its length was copied");
+            ensure(pwrite(destination, buffer.data(), count, offset) == count);
+            offset += count;
+        }
+    }
+
+    Method m_method;
+};
+
+// The distance between the starts of neighbouring header entries in the
+// inplace layout, which pads entries when it is larger than an entry.
+size_t header_entry_stride = sizeof(header_entry);
+
+// Updating a header entry produces the extent that must be written to page 0.
+// The extent's data remains valid until the next update.
+class HeaderLayout {
+public:
+    virtual ~HeaderLayout() {}
+    virtual WriteExtent update(size_t index, const header_entry& entry) = 0;
+
+    // Called before the file is extended at offset to hold record_count more
+    // records. Returns the number of bytes the layout places ahead of them.
+    virtual size_t reserve(off_t offset, size_t record_count) { return 0; }
+
+    // Returns, and forgets, the writes that make reserved space reachable, which
+    // must be durable before any entry is written to it.
+    virtual std::vector<WriteExtent> takeIndexWrites() { return std::vector<WriteExtent>(); }
+
+    // The most records the layout can hold entries for, and the bytes it
+    // reserves in a file holding record_count of them.
+    virtual size_t recordCapacity() const { return SIZE_MAX; }
+    virtual size_t reservedBytes(size_t record_count) const { return 0; }
+};
+
+class InPlaceHeaderLayout : public HeaderLayout {
+public:
+    static std::unique_ptr<HeaderLayout> create()
+    {
+        return std::unique_ptr<HeaderLayout>(new InPlaceHeaderLayout);
+    }
+
+    InPlaceHeaderLayout()
+        : m_entries()
+    {}
+
+    WriteExtent update(size_t index, const header_entry& entry) override
+    {
+        m_entries[index] = entry;
+        WriteExtent extent = { off_t(index * header_entry_stride), &m_entries[index], sizeof(entry) };
+        return extent;
+    }
+
+private:
+    header_entry m_entries[header_entry_count];
+};
+
+class ABHeaderLayout : public HeaderLayout {
+public:
+    static std::unique_ptr<HeaderLayout> create()
+    {
+        return std::unique_ptr<HeaderLayout>(new ABHeaderLayout);
+    }
+
+    ABHeaderLayout()
+        : m_slot()
+    {
+        m_slot.magic = header_slot_magic;
+    }
+
+    WriteExtent update(size_t index, const header_entry& entry) override
+    {
+        m_slot.entries[index] = entry;
+        ++m_slot.sequence;
+        m_slot.checksum = header_slot_checksum(m_slot);
+        WriteExtent extent = { off_t(header_slot_offset(m_slot.sequence)), &m_slot, sizeof(m_slot) };
+        return extent;
+    }
+
+private:
+    header_slot m_slot;
+};
+
+// Keeps an entry for every record in the file in index pages, which a radix
+// root on page 0 refers to. Each update writes one entry in an index page; the
+// root is only written when the file is extended and needs a new index page.
+class RadixHeaderLayout : public HeaderLayout {
+public:
+    static std::unique_ptr<HeaderLayout> create()
+    {
+        return std::unique_ptr<HeaderLayout>(new RadixHeaderLayout);
+    }
+
+    RadixHeaderLayout()
+        : m_root()
+        , m_record_count(0)
+        , m_root_changed(false)
+    {
+        m_root.magic = radix_root_magic;
+    }
+
+    WriteExtent update(size_t index, const header_entry& entry) override
+    {
+        auto first_record = m_first_records.find(entry.offset);
+        assert(first_record != m_first_records.end());
+        size_t record = first_record->second + index;
+        header_entry& page_entry = m_pages[record / index_page_entry_count][record % index_page_entry_count];
+        page_entry = entry;
+        WriteExtent extent = { off_t(m_root.pages[record / index_page_entry_count] + record % index_page_entry_count * sizeof(entry)), &page_entry, sizeof(entry) };
+        return extent;
+    }
+
+    size_t reserve(off_t offset, size_t record_count) override
+    {
+        size_t bytes = 0;
+        size_t pages_needed = (m_record_count + record_count + index_page_entry_count - 1) / index_page_entry_count;
+        while (m_pages.size() < pages_needed) {
+            if (m_root.page_count == radix_root_capacity)
+                throw std::length_error("The radix index is full");
+            m_root.pages[m_root.page_count++] = offset + bytes;
+            m_pages.push_back(std::vector<header_entry>(index_page_entry_count));
+            bytes += index_page_size;
+            m_root_changed = true;
+        }
+        m_first_records[offset + bytes] = m_record_count;
+        m_record_count += record_count;
+        return bytes;
+    }
+
+    std::vector<WriteExtent> takeIndexWrites() override
+    {
+        std::vector<WriteExtent> extents;
+        if (m_root_changed) {
+            WriteExtent extent = { 0, &m_root, sizeof(m_root) };
+            extents.push_back(extent);
+            m_root_changed = false;
+        }
+        return extents;
+    }
+
+    size_t recordCapacity() const override
+    {
+        return radix_root_capacity * index_page_entry_count;
+    }
+
+    size_t reservedBytes(size_t record_count) const override
+    {
+        return (record_count + index_page_entry_count - 1) / index_page_entry_count * index_page_size;
+    }
+
+private:
+    radix_root m_root;
+    std::vector<std::vector<header_entry>> m_pages;
+    // The number of the first record in each extension of the file, by the offset of its records.
+    std::unordered_map<off_t, size_t> m_first_records;
+    size_t m_record_count;
+    bool m_root_changed;
+};
+
+std::vector<SyncStrategy*> write_sync_strategies;
+std::vector<SyncStrategy*> extend_sync_strategies;
+std::function<std::unique_ptr<WriteStrategy> (std::string, std::string)> writer_factory;
+std::function<std::unique_ptr<HeaderLayout> ()> header_layout_factory;
+std::unique_ptr<HeaderLayout> header_layout;
+std::string strategy_description;
+std::chrono::milliseconds transaction_delay(50);
+std::unique_ptr<Snapshotter> snapshotter;
+size_t snapshot_interval = 0;
+std::string record_size_string = "page";
+size_t record_size = 0;
+size_t record_offset = 0;
+size_t extension_count = 1024;
+std::chrono::seconds run_duration(0);
+std::string summary_file_name;
+std::string experiments_file_name;
+std::vector<std::string> working_directories = { "working" };
+size_t workers_per_device = 1;
+bool isolate_experiments = false;
+std::string sweep_sizes_string;
+std::string sweep_offsets_string;
+size_t writer_count = 1;
+bool coalesce_syncs = false;
+bool file_pool_enabled = false;
+uint64_t workload_seed = 0;
+// Receives a line for every commit as it is acknowledged, naming the test file,
+// the number of the transaction in the workload's order and the time in
+// microseconds since the epoch. It must survive the power loss to be of use.
+FILE* ack_log = nullptr;
+bool random_order = false;
+std::string command_line;
+
+// A transaction makes a new version of one data record, record_size bytes long,
+// durable along with the header entry that refers to it.
+class TransactionProtocol {
+public:
+    virtual ~TransactionProtocol() {}
+    virtual void extend(off_t length) = 0;
+    virtual void commit(size_t index, void* record, const header_entry& header) = 0;
+
+    // Calls the function for each file holding the protocol's state, with no
+    // writes to those files in progress.
+    virtual void forEachFile(const std::function<void (const WriteStrategy&)>& function) = 0;
+};
+
+// Writes the data page in place, then updates the header entry in place, with
+// the write sync strategies used as a barrier after each.
+class InPlaceProtocol : public TransactionProtocol {
+public:
+    static std::unique_ptr<TransactionProtocol> create(const std::string& directory, const std::string& file_name)
+    {
+        return std::unique_ptr<TransactionProtocol>(new InPlaceProtocol(directory, file_name));
+    }
+
+    InPlaceProtocol(const std::string& directory, const std::string& file_name)
+        : m_writer(writer_factory(directory, file_name))
+    {}
+
+    void extend(off_t length) override
+    {
+        {
+            ScopedPhase phase(phase_extend);
+            m_writer->extend(length);
+            for (const auto& extent : header_layout->takeIndexWrites())
+                m_writer->write(extent.offset, extent.data, extent.length);
+        }
+        ScopedPhase phase(phase_sync);
+        m_writer->sync(extend_sync_strategies);
+    }
+
+    void commit(size_t index, void* record, const header_entry& header) override
+    {
+        size_t offset = header.offset + index * record_size;
+        if (!contains_barrier(write_sync_strategies)) {
+            // Nothing orders the data write before the header write, so issue them together.
+            fprintf(stderr, "Writing index %zu, version %zu at offset %zu and header portion of file...", index, header.version, offset);
+            {
+                ScopedPhase phase(phase_data_write);
+                WriteExtent data = { off_t(offset), record, record_size };
+                m_writer->writeBatch({ data, header_layout->update(index, header) }, write_flag_none);
+            }
+            {
+                ScopedPhase phase(phase_sync);
+                m_writer->sync(write_sync_strategies);
+            }
+            fprintf(stderr, " done!\n");
+            return;
+        }
+
+        // Simulate updating the data portion of the file.
+        fprintf(stderr, "Writing index %zu, version %zu at offset %zu...", index, header.version, offset);
+        {
+            ScopedPhase phase(phase_data_write);
+            m_writer->write(offset, record, record_size);
+        }
+        {
+            ScopedPhase phase(phase_sync);
+            m_writer->sync(write_sync_strategies);
+        }
+        fprintf(stderr, " done!\n");
+
+        // Simulate updating the header portion of the file.
+        fprintf(stderr, "Updating header portion of file...");
+        {
+            ScopedPhase phase(phase_header_write);
+            WriteExtent extent = header_layout->update(index, header);
+            m_writer->write(extent.offset, extent.data, extent.length);
+        }
+        {
+            ScopedPhase phase(phase_sync);
+            m_writer->sync(write_sync_strategies);
+        }
+        fprintf(stderr, " done!\n");
+    }
+
+    void forEachFile(const std::function<void (const WriteStrategy&)>& function) override
+    {
+        function(*m_writer);
+    }
+
+private:
+    std::unique_ptr<WriteStrategy> m_writer;
+};
+
+// Appends each transaction to a write-ahead log with a single sync, and leaves
+// a background thread to checkpoint the pages and header entries into the
+// data file. The data file is only synced once per checkpoint batch.
+class WALProtocol : public TransactionProtocol {
+public:
+    static std::unique_ptr<TransactionProtocol> create(const std::string& directory, const std::string& file_name)
+    {
+        return std::unique_ptr<TransactionProtocol>(new WALProtocol(directory, file_name));
+    }
+
+    WALProtocol(const std::string& directory, const std::string& file_name)
+        : m_writer(writer_factory(directory, file_name))
+        , m_log(writer_factory(directory, wal_file_name(file_name)))
+        , m_sequence(0)
+        , m_log_length(0)
+        , m_stopping(false)
+        , m_checkpointer(&WALProtocol::checkpoint, this)
+    {}
+
+    ~WALProtocol()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_work_available.notify_one();
+        m_checkpointer.join();
+
+        // An error in the last batch has no commit left to report it.
+        if (m_checkpoint_error) {
+            try {
+                std::rethrow_exception(m_checkpoint_error);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Checkpoint failed: %s\n", e.what());
+            }
+        }
+    }
+
+    void extend(off_t length) override
+    {
+        // The checkpointer extends the data file before applying the records that need the space.
+        PendingOperation operation = { length, 0, {} };
+        enqueue(std::move(operation));
+    }
+
+    void commit(size_t index, void* data, const header_entry& header) override
+    {
+        std::vector<char> record_buffer(wal_record_size(record_size));
+        wal_record* record = reinterpret_cast<wal_record*>(record_buffer.data());
+        record->magic = wal_record_magic;
+        record->sequence = ++m_sequence;
+        record->slot = index;
+        record->length = record_size;
+        record->header = header;
+        memcpy(record + 1, data, record_size);
+        record->checksum = wal_record_checksum(*record, record + 1);
+
+        if (m_log_length + record_buffer.size() > m_log->length()) {
+            {
+                ScopedPhase phase(phase_extend);
+                m_log->extend(m_log->length() + log_extend_record_count * record_buffer.size());
+            }
+            ScopedPhase phase(phase_sync);
+            m_log->sync(extend_sync_strategies);
+        }
+
+        // The log record carries both the data record and the header entry.
+        fprintf(stderr, "Appending log record %llu for index %zu, version %zu...", (unsigned long long)record->sequence, index, header.version);
+        {
+            ScopedPhase phase(phase_data_write);
+            m_log->write(m_log_length, record_buffer.data(), record_buffer.size());
+        }
+        {
+            ScopedPhase phase(phase_sync);
+            m_log->sync(write_sync_strategies);
+        }
+        m_log_length += record_buffer.size();
+        fprintf(stderr, " done!\n");
+
+        PendingOperation operation = { 0, index, std::move(record_buffer) };
+        enqueue(std::move(operation));
+    }
+
+    void forEachFile(const std::function<void (const WriteStrategy&)>& function) override
+    {
+        std::lock_guard<std::mutex> lock(m_checkpoint_mutex);
+        function(*m_writer);
+        function(*m_log);
+    }
+
+private:
+    static const size_t log_extend_record_count = 128;
+    static const size_t max_pending_operations = 1024;
+
+    struct PendingOperation {
+        off_t extend_length;
+        size_t index;
+        std::vector<char> record;
+    };
+
+    // A checkpoint that failed is reported by the next commit or extend, since
+    // an exception cannot leave the checkpointer thread.
+    void enqueue(PendingOperation&& operation)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_space_available.wait(lock, [this] { return m_checkpoint_error || m_pending.size() < max_pending_operations; });
+        if (m_checkpoint_error)
+            std::rethrow_exception(m_checkpoint_error);
+        m_pending.push_back(std::move(operation));
+        m_work_available.notify_one();
+    }
+
+    void checkpoint()
+    {
+        try {
+            checkpointBatches();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_checkpoint_error = std::current_exception();
+            m_space_available.notify_all();
+        }
+    }
+
+    void checkpointBatches()
+    {
+        std::deque<PendingOperation> batch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_work_available.wait(lock, [this] { return m_stopping || !m_pending.empty(); });
+                if (m_pending.empty())
+                    return;
+                batch.swap(m_pending);
+            }
+            m_space_available.notify_all();
+
+            // The pages of a batch go out in one writeBatch call, which coalesces
+            // neighbouring pages. Header entries are written after their pages.
+            std::lock_guard<std::mutex> checkpoint_lock(m_checkpoint_mutex);
+            std::vector<WriteExtent> pages;
+            std::vector<std::pair<size_t, const header_entry*>> headers;
+            for (auto& operation : batch) {
+                if (operation.extend_length) {
+                    writePages(pages, headers);
+                    m_writer->extend(operation.extend_length);
+                    m_writer->sync(extend_sync_strategies);
+                    continue;
+                }
+                wal_record* record = reinterpret_cast<wal_record*>(operation.record.data());
+                WriteExtent page = { off_t(record->header.offset + operation.index * record->length), record + 1, size_t(record->length) };
+                pages.push_back(page);
+                headers.push_back(std::make_pair(operation.index, &record->header));
+            }
+            writePages(pages, headers);
+            m_writer->sync(write_sync_strategies);
+            batch.clear();
+        }
+    }
+
+    void writePages(std::vector<WriteExtent>& pages, std::vector<std::pair<size_t, const header_entry*>>& headers)
+    {
+        m_writer->writeBatch(pages, write_flag_none);
+        for (const auto& header : headers) {
+            WriteExtent extent = header_layout->update(header.first, *header.second);
+            m_writer->write(extent.offset, extent.data, extent.length);
+        }
+        pages.clear();
+        headers.clear();
+    }
+
+    std::unique_ptr<WriteStrategy> m_writer;
+    std::unique_ptr<WriteStrategy> m_log;
+    uint64_t m_sequence;
+    size_t m_log_length;
+
+    std::mutex m_mutex;
+    std::mutex m_checkpoint_mutex;
+    std::condition_variable m_work_available;
+    std::condition_variable m_space_available;
+    std::deque<PendingOperation> m_pending;
+    bool m_stopping;
+    std::exception_ptr m_checkpoint_error;
+    std::thread m_checkpointer;
+};
+
+// Writes each new version of a data record, and a new copy of the table of
+// header entries, to free slots. A single write of the root on page 0 then
+// commits the transaction, after which the slots holding the previous versions
+// are recycled. Slots are big enough for either a record or the table.
+class ShadowPagingProtocol : public TransactionProtocol {
+public:
+    static std::unique_ptr<TransactionProtocol> create(const std::string& directory, const std::string& file_name)
+    {
+        return std::unique_ptr<TransactionProtocol>(new ShadowPagingProtocol(directory, file_name));
+    }
+
+    ShadowPagingProtocol(const std::string& directory, const std::string& file_name)
+        : m_writer(writer_factory(directory, file_name))
+        , m_slot_size(std::max<size_t>(record_size, (sizeof(shadow_table) + 511) / 512 * 512))
+        , m_table()
+        , m_root()
+    {
+        m_root.magic = shadow_root_magic;
+    }
+
+    void extend(off_t) override
+    {
+        // Pages are allocated on demand, so the file only grows when the free list runs out.
+    }
+
+    void commit(size_t index, void* record, const header_entry& header) override
+    {
+        off_t old_page_offset = m_table.page_offsets[index];
+        off_t old_table_offset = m_root.table_offset;
+
+        off_t page_offset = allocate();
+        off_t table_offset = allocate();
+        m_table.entries[index] = header;
+        m_table.page_offsets[index] = page_offset;
+
+        // Nothing needs to order the page and table writes against each other.
+        fprintf(stderr, "Writing index %zu, version %zu at offset %zu and table at offset %zu...", index, header.version, (size_t)page_offset, (size_t)table_offset);
+        {
+            ScopedPhase phase(phase_data_write);
+            WriteExtent page_extent = { page_offset, record, record_size };
+            WriteExtent table_extent = { table_offset, &m_table, sizeof(m_table) };
+            m_writer->writeBatch({ page_extent, table_extent }, write_flag_none);
+        }
+        {
+            ScopedPhase phase(phase_sync);
+            m_writer->sync(write_sync_strategies);
+        }
+        fprintf(stderr, " done!\n");
+
+        fprintf(stderr, "Updating root...");
+        ++m_root.sequence;
+        m_root.table_offset = table_offset;
+        m_root.table_checksum = checksum(&m_table, sizeof(m_table));
+        m_root.checksum = shadow_root_checksum(m_root);
+        {
+            ScopedPhase phase(phase_header_write);
+            m_writer->write(0, &m_root, sizeof(m_root));
+        }
+        {
+            ScopedPhase phase(phase_sync);
+            m_writer->sync(write_sync_strategies);
+        }
+        fprintf(stderr, " done!\n");
+
+        if (old_page_offset)
+            m_free_pages.push_back(old_page_offset);
+        if (old_table_offset)
+            m_free_pages.push_back(old_table_offset);
+    }
+
+    void forEachFile(const std::function<void (const WriteStrategy&)>& function) override
+    {
+        function(*m_writer);
+    }
+
+private:
+    static const size_t allocation_slot_count = 16;
+
+    off_t allocate()
+    {
+        if (m_free_pages.empty()) {
+            // Page 0 is reserved for the root.
+            off_t old_length = std::max<off_t>(m_writer->length(), header_page_size + record_offset);
+            off_t new_length = old_length + allocation_slot_count * m_slot_size;
+            fprintf(stderr, "Growing file to %zu bytes.\n", (size_t)new_length);
+            {
+                ScopedPhase phase(phase_extend);
+                m_writer->extend(new_length);
+            }
+            {
+                ScopedPhase phase(phase_sync);
+                m_writer->sync(extend_sync_strategies);
+            }
+            for (off_t offset = new_length - m_slot_size; offset >= old_length; offset -= m_slot_size)
+                m_free_pages.push_back(offset);
+        }
+
+        off_t offset = m_free_pages.back();
+        m_free_pages.pop_back();
+        return offset;
+    }
+
+    std::unique_ptr<WriteStrategy> m_writer;
+    size_t m_slot_size;
+    shadow_table m_table;
+    shadow_root m_root;
+    std::vector<off_t> m_free_pages;
+};
+
+std::function<std::unique_ptr<TransactionProtocol> (std::string, std::string)> protocol_factory;
+
+std::string current_timestamp()
 {
     time_t now = time(0);
     struct tm tstruct;
@@ -217,9 +2213,21 @@ std::string current_timestamp()
     return buf;
 }
 
+// Names a run after the time it started. The process ID, and the number of runs
+// the process has made, keep apart the names of runs started in the same second.
+std::string run_name()
+{
+    static size_t run_count = 0;
+    std::string name = current_timestamp() + "." + std::to_string(getpid());
+    if (++run_count > 1)
+        name += "." + std::to_string(run_count);
+    return name;
+}
+
 static const std::unordered_map<std::string, SyncStrategy*> sync_strategies_by_name = { {"none", new NoopSyncStrategy}, {"msync", new MSyncStrategy},
                                                                                         {"fsync", new FSyncStrategy}, {"fullfsync", new FullFSyncStrategy},
-                                                                                        {"fsyncparent", new FSyncParentStrategy} };
+                                                                                        {"fsyncparent", new FSyncParentStrategy}, {"fdatasync", new FDataSyncStrategy},
+                                                                                        {"syncfilerange", new SyncFileRangeStrategy}, {"syncfs", new SyncFSStrategy} };
 
 std::vector<SyncStrategy*> sync_strategies_from_string(char* strategy_list_string)
 {
@@ -238,87 +2246,1066 @@ std::vector<SyncStrategy*> sync_strategies_from_string(char* strategy_list_strin
     return strategies;
 }
 
+// Lists the calls the strategies make, which are only known for certain once they have run.
+std::string sync_primitives(const std::vector<SyncStrategy*>& strategies)
+{
+    std::string primitives;
+    for (auto* st : strategies)
+        primitives += (primitives.empty() ? "" : ", ") + std::string(st->primitive());
+    return primitives;
+}
+
+// Parses a record size in bytes, or as one of the detected sizes optionally
+// multiplied or divided by a number, e.g. "psector*2" or "page/8".
+size_t record_size_from_string(const std::string& record_size_string, const Geometry& geometry)
+{
+    size_t operator_position = record_size_string.find_first_of("*/");
+    std::string base = record_size_string.substr(0, operator_position);
+    size_t size;
+    if (base == "page")
+        size = geometry.page_size;
+    else if (base == "fsblock")
+        size = geometry.filesystem_block_size;
+    else if (base == "lsector")
+        size = geometry.logical_sector_size;
+    else if (base == "psector")
+        size = geometry.physical_sector_size;
+    else
+        size = std::stoul(base);
+
+    if (operator_position != std::string::npos) {
+        size_t operand = std::stoul(record_size_string.substr(operator_position + 1));
+        if (!operand)
+            throw std::domain_error("Cannot scale a record size by zero");
+        if (record_size_string[operator_position] == '*')
+            size *= operand;
+        else
+            size /= operand;
+    }
+
+    if (size < 512 || size > 1 << 20)
+        throw std::domain_error("Record size must be between 512 bytes and 1 MiB");
+    return size;
+}
+
+void mmap_advice_from_string(const std::string& advice_list_string)
+{
+    for (const auto& advice : split_list(advice_list_string)) {
+        if (advice == "sequential")
+            mmap_options.access_advice = MADV_SEQUENTIAL;
+        else if (advice == "random")
+            mmap_options.access_advice = MADV_RANDOM;
+        else if (advice == "willneed")
+            mmap_options.will_need = true;
+#ifdef MADV_HUGEPAGE
+        else if (advice == "hugepage")
+            mmap_options.huge_pages = true;
+#endif
+#ifdef MADV_POPULATE_WRITE
+        else if (advice == "populate-write")
+            mmap_options.populate_write = true;
+#endif
+        else
+            throw std::domain_error("Unknown or unsupported mmap advice");
+    }
+}
+
 void initialize_from_arguments(int argc, char** argv)
 {
+    static const struct option options[] = {
+        { "header", required_argument, nullptr, 'h' },
+        { "protocol", required_argument, nullptr, 'p' },
+        { "delay", required_argument, nullptr, 'd' },
+        { "snapshot-every", required_argument, nullptr, 'n' },
+        { "snapshot", required_argument, nullptr, 's' },
+        { "mmap-populate", no_argument, nullptr, 'P' },
+        { "mmap-advice", required_argument, nullptr, 'a' },
+        { "counters", no_argument, nullptr, 'c' },
+        { "file-pool", no_argument, nullptr, 'f' },
+        { "record-size", required_argument, nullptr, 'r' },
+        { "record-offset", required_argument, nullptr, 'o' },
+        { "extensions", required_argument, nullptr, 'e' },
+        { "sweep-sizes", required_argument, nullptr, 'S' },
+        { "sweep-offsets", required_argument, nullptr, 'O' },
+        { "writers", required_argument, nullptr, 'w' },
+        { "coalesce-syncs", no_argument, nullptr, 'C' },
+        { "duration", required_argument, nullptr, 'D' },
+        { "summary", required_argument, nullptr, 'u' },
+        { "experiments", required_argument, nullptr, 'x' },
+        { "jobs-per-device", required_argument, nullptr, 'j' },
+        { "isolate", no_argument, nullptr, 'i' },
+        { "working", required_argument, nullptr, 'W' },
+        { "device", required_argument, nullptr, 'v' },
+        { "seed", required_argument, nullptr, 'z' },
+        { "entry-spacing", required_argument, nullptr, 'g' },
+        { "random-order", no_argument, nullptr, 'm' },
+        { "ack-log", required_argument, nullptr, 'k' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    std::string header_layout_string = "inplace";
+    std::string protocol_string = "inplace";
+    std::string snapshot_string = "auto";
+    std::string device_string;
+    std::string entry_spacing_string = "packed";
+    std::string strategy_description_suffix;
+    bool seed_given = false;
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (option) {
+        case 'h':
+            header_layout_string = optarg;
+            break;
+        case 'p':
+            protocol_string = optarg;
+            break;
+        case 'd':
+            transaction_delay = std::chrono::milliseconds(std::stoul(optarg));
+            break;
+        case 'n':
+            snapshot_interval = std::stoul(optarg);
+            break;
+        case 's':
+            snapshot_string = optarg;
+            break;
+        case 'P':
+#ifndef MAP_POPULATE
+            throw std::domain_error("MAP_POPULATE is not supported on this platform");
+#endif
+            mmap_options.populate = true;
+            strategy_description_suffix += "-populate";
+            break;
+        case 'c':
+            io_counters_enabled = true;
+            break;
+        case 'r':
+            record_size_string = optarg;
+            break;
+        case 'o':
+            record_offset = std::stoul(optarg);
+            break;
+        case 'e':
+            extension_count = std::stoul(optarg);
+            if (!extension_count)
+                throw std::domain_error("At least one extension is needed");
+            break;
+        case 'S':
+            sweep_sizes_string = optarg;
+            break;
+        case 'O':
+            sweep_offsets_string = optarg;
+            break;
+        case 'C':
+            coalesce_syncs = true;
+            break;
+        case 'w':
+            writer_count = std::stoul(optarg);
+            if (!writer_count || writer_count > header_entry_count)
+                throw std::domain_error("There can be from 1 to 16 writers, one for each header entry");
+            break;
+        case 'D':
+            run_duration = std::chrono::seconds(std::stoul(optarg));
+            break;
+        case 'u':
+            summary_file_name = optarg;
+            break;
+        case 'x':
+            experiments_file_name = optarg;
+            break;
+        case 'j':
+            workers_per_device = std::stoul(optarg);
+            if (!workers_per_device)
+                throw std::domain_error("At least one job per device is needed");
+            break;
+        case 'i':
+            isolate_experiments = true;
+            break;
+        case 'v':
+            device_string = optarg;
+            break;
+        case 'g':
+            entry_spacing_string = optarg;
+            break;
+        case 'z':
+            workload_seed = std::stoull(optarg);
+            seed_given = true;
+            break;
+        case 'k':
+            ack_log = strcmp(optarg, "-") ? fopen(optarg, "a") : stdout;
+            ensure(ack_log);
+            setvbuf(ack_log, nullptr, _IOLBF, 0);
+            break;
+        case 'm':
+            random_order = true;
+            strategy_description_suffix += "-random";
+            break;
+        case 'W':
+            working_directories = split_list(optarg);
+            for (const auto& directory : working_directories) {
+                if (directory.empty())
+                    throw std::domain_error("Working directories cannot be empty");
+            }
+            break;
+        case 'f':
+            file_pool_enabled = true;
+            strategy_description_suffix += "-pool";
+            break;
+        case 'a': {
+            mmap_advice_from_string(optarg);
+            // Commas would split the test file name, which is a column in CSV files.
+            std::string advice = optarg;
+            std::replace(advice.begin(), advice.end(), ',', '+');
+            strategy_description_suffix += "-" + advice;
+            break;
+        }
+        default:
+            throw std::invalid_argument("Unknown option.");
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (!seed_given) {
+        std::random_device device;
+        workload_seed = (uint64_t(device()) << 32) | device();
+    }
+
+    // Each experiment is parsed again by the run that executes it.
+    if (!experiments_file_name.empty()) {
+        if (argc != 1)
+            throw std::length_error("Expected no arguments after options with --experiments.");
+        return;
+    }
+
     if (argc != 4)
-        throw std::length_error("Expected 4 arguments.");
+        throw std::length_error("Expected 3 arguments after options.");
+
+    // Recorded in the test file name so verify can group its results by strategy.
+    strategy_description = std::string(argv[1]) + "-" + argv[2] + "-" + argv[3] + strategy_description_suffix;
 
     std::string write_strategy_string = argv[1];
     if (write_strategy_string == "mmap")
         writer_factory = MMapWriteStrategy::create;
     else if (write_strategy_string == "write")
         writer_factory = PWriteWriteStrategy::create;
-    else
+#ifdef RWF_DSYNC
+    else if (write_strategy_string == "write-dsync")
+        writer_factory = PWriteWriteStrategy::createDSync;
+    else if (write_strategy_string == "write-hipri")
+        writer_factory = PWriteWriteStrategy::createHighPriority;
+    else if (write_strategy_string == "write-dsync-hipri")
+        writer_factory = PWriteWriteStrategy::createDSyncHighPriority;
+#endif
+    else if (write_strategy_string == "replace")
+        writer_factory = ReplaceWriteStrategy::create;
+    else if (write_strategy_string == "replace-exchange")
+        writer_factory = ReplaceWriteStrategy::createExchange;
+    else if (write_strategy_string == "emulated" || write_strategy_string == "emulated-dsync") {
+        writer_factory = write_strategy_string == "emulated" ? EmulatedWriteStrategy::create : EmulatedWriteStrategy::createDSync;
+        emulated_device.reset(new EmulatedDevice(EmulatedDevice::profile_from_string(device_string.empty() ? "nvme" : device_string)));
+        strategy_description += "-" + emulated_device->profile().name;
+    } else
         throw std::domain_error("Unknown write strategy");
+    if (!device_string.empty() && !emulated_device)
+        throw std::domain_error("--device needs the emulated write strategy");
+    // The emulated device serializes its commands, so there are no concurrent flushes to coalesce.
+    if (coalesce_syncs && emulated_device)
+        throw std::domain_error("--coalesce-syncs has no effect with the emulated write strategy");
 
     write_sync_strategies = sync_strategies_from_string(argv[2]);
+    if (coalesce_syncs) {
+        for (auto*& st : write_sync_strategies) {
+            if (!st->isBarrier())
+                continue;
+            coalescing_sync_strategies.push_back(new CoalescingSyncStrategy(st));
+            st = coalescing_sync_strategies.back();
+        }
+        strategy_description += "-coalesce";
+    }
     extend_sync_strategies = sync_strategies_from_string(argv[3]);
-}
 
-int main(int argc, char** argv)
-{
-    try {
-        initialize_from_arguments(argc, argv);
-    } catch (const std::exception& e) {
-        fprintf(stderr, "%s\n", e.what());
-        fprintf(stderr, "Usage: main [mmap|write] write-sync-strategy-list extend-sync-strategy-list\n");
-        return 1;
+    if (entry_spacing_string == "cacheline")
+        header_entry_stride = 64;
+    else if (entry_spacing_string == "sector")
+        header_entry_stride = 512;
+    else if (entry_spacing_string == "page")
+        header_entry_stride = 4096;
+    else if (entry_spacing_string != "packed")
+        throw std::domain_error("Unknown entry spacing");
+    if (header_entry_stride != sizeof(header_entry)) {
+        if (header_layout_string != "inplace" || protocol_string == "shadow")
+            throw std::domain_error("Entry spacing needs the inplace header layout");
+        strategy_description += "-entry-" + entry_spacing_string;
     }
 
-    std::string working_directory = "working";
-    if (mkdir(working_directory.c_str(), 0777) && errno != EEXIST) {
-        perror("mkdir");
-        return 1;
+    if (header_layout_string == "inplace")
+        header_layout_factory = InPlaceHeaderLayout::create;
+    else if (header_layout_string == "ab") {
+        header_layout_factory = ABHeaderLayout::create;
+        strategy_description += "-ab";
+    } else if (header_layout_string == "radix") {
+        header_layout_factory = RadixHeaderLayout::create;
+        strategy_description += "-radix";
+        if (protocol_string != "inplace")
+            throw std::domain_error("The radix index needs the inplace protocol");
+        if (!run_duration.count() && extension_count * header_entry_count > radix_root_capacity * index_page_entry_count)
+            throw std::domain_error("The radix index cannot hold the records of that many extensions");
+    } else
+        throw std::domain_error("Unknown header layout");
+
+    if (protocol_string == "inplace")
+        protocol_factory = InPlaceProtocol::create;
+    else if (protocol_string == "wal") {
+        protocol_factory = WALProtocol::create;
+        strategy_description += "-wal";
+    } else if (protocol_string == "shadow") {
+        if (header_layout_string != "inplace")
+            throw std::domain_error("Shadow paging commits through its own root rather than a header layout");
+        protocol_factory = ShadowPagingProtocol::create;
+        strategy_description += "-shadow";
+    } else
+        throw std::domain_error("Unknown transaction protocol");
+
+    if (snapshot_interval) {
+        if (snapshot_string == "auto")
+            snapshotter.reset(new Snapshotter(Snapshotter::Auto));
+        else if (snapshot_string == "clone")
+            snapshotter.reset(new Snapshotter(Snapshotter::Clone));
+        else if (snapshot_string == "copy-range")
+            snapshotter.reset(new Snapshotter(Snapshotter::CopyRange));
+        else if (snapshot_string == "stream")
+            snapshotter.reset(new Snapshotter(Snapshotter::Stream));
+        else
+            throw std::domain_error("Unknown snapshot method");
+    }
+
+    // Writers own disjoint header entries and records, so they only need the
+    // protocol and layout that update both in place.
+    if (writer_count > 1) {
+        if (protocol_string != "inplace" || header_layout_string != "inplace")
+            throw std::domain_error("Multiple writers need the inplace protocol and header layout");
+        if (write_strategy_string == "replace" || write_strategy_string == "replace-exchange")
+            throw std::domain_error("Multiple writers cannot share a file that is replaced on every write");
+        if (snapshotter)
+            throw std::domain_error("Snapshots need a single writer");
+        strategy_description += "-w" + std::to_string(writer_count);
+    }
+
+    // Each publish renames a new file over the one taken from the pool.
+    if (file_pool_enabled && (write_strategy_string == "replace" || write_strategy_string == "replace-exchange"))
+        throw std::domain_error("The file pool cannot be used with a file that is replaced on every write");
+}
+
+// Blocks each caller until the given number of threads have called wait.
+class Barrier {
+public:
+    explicit Barrier(size_t count)
+        : m_count(count)
+        , m_waiting(0)
+        , m_generation(0)
+    {}
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        size_t generation = m_generation;
+        if (++m_waiting == m_count) {
+            m_waiting = 0;
+            ++m_generation;
+            m_released.notify_all();
+            return;
+        }
+        m_released.wait(lock, [&] { return m_generation != generation; });
     }
 
-    std::string test_file_name = "test-" + current_timestamp() + ".dat";
-    fprintf(stderr, "Test file: %s\n", test_file_name.c_str());
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+    size_t m_count;
+    size_t m_waiting;
+    size_t m_generation;
+};
+
+struct WorkloadResult {
+    std::string test_file_name;
+    size_t record_size = 0;
+    size_t record_offset = 0;
+    LatencyStats commit_latency;
+    long long application_bytes = 0;
+};
+
+static const char* const result_csv_header = "record_size,record_offset,commits,seconds,commits_per_second,mib_per_second,mean_us,p50_us,p99_us,max_us,test_file";
+
+void write_result_row(FILE* file, const WorkloadResult& result)
+{
+    const LatencyStats& latency = result.commit_latency;
+    double seconds = latency.totalSeconds();
+    fprintf(file, "%zu,%zu,%zu,%.6f,%.1f,%.3f,%.1f,%.1f,%.1f,%.1f,%s\n", result.record_size, result.record_offset, latency.count(), seconds,
+        latency.count() / seconds, result.application_bytes / seconds / (1 << 20), seconds * 1e6 / latency.count(),
+        latency.percentile(0.5), latency.percentile(0.99), latency.percentile(1), result.test_file_name.c_str());
+    fflush(file);
+}
+
+// Records how a run was made next to its test file, and makes the record
+// durable before the test file exists, so that verify can tell after a power
+// loss what the file should hold and results can be reproduced.
+void write_manifest(const std::string& working_directory, const std::string& test_file_name, const std::string& description,
+    size_t records_per_extension, size_t versions_per_extension)
+{
+    std::string path = working_directory + "/" + manifest_file_name(test_file_name);
+    FILE* file = fopen(path.c_str(), "w");
+    ensure(file);
+    struct utsname host;
+    ensure(uname(&host) == 0);
+    fprintf(file, "file=%s\n", test_file_name.c_str());
+    fprintf(file, "started=%s\n", current_timestamp().c_str());
+    fprintf(file, "command=%s\n", command_line.c_str());
+    fprintf(file, "strategy=%s\n", description.c_str());
+    fprintf(file, "seed=%llu\n", (unsigned long long)workload_seed);
+    fprintf(file, "random_order=%d\n", random_order);
+    fprintf(file, "record_size=%zu\n", record_size);
+    fprintf(file, "record_offset=%zu\n", record_offset);
+    fprintf(file, "records_per_extension=%zu\n", records_per_extension);
+    fprintf(file, "versions_per_extension=%zu\n", versions_per_extension);
+    fprintf(file, "extensions=%zu\n", extension_count);
+    fprintf(file, "duration_seconds=%lld\n", (long long)run_duration.count());
+    fprintf(file, "entry_stride=%zu\n", header_entry_stride);
+    fprintf(file, "writers=%zu\n", writer_count);
+    fprintf(file, "delay_ms=%lld\n", (long long)transaction_delay.count());
+    fprintf(file, "host=%s\n", host.nodename);
+    fprintf(file, "system=%s %s %s\n", host.sysname, host.release, host.machine);
+    fprintf(file, "page_size=%zu\n", geometry.page_size);
+    fprintf(file, "filesystem_block_size=%zu\n", geometry.filesystem_block_size);
+    fprintf(file, "logical_sector_size=%zu\n", geometry.logical_sector_size);
+    fprintf(file, "physical_sector_size=%zu\n", geometry.physical_sector_size);
+    ensure(fflush(file) == 0);
+    ensure(fsync(fileno(file)) == 0);
+    fclose(file);
+
+    // The manifest's directory entry must be durable too.
+    int directory_fd = open(working_directory.c_str(), O_RDONLY);
+    ensure(directory_fd != -1);
+    ensure(fsync(directory_fd) == 0);
+    close(directory_fd);
+}
+
+// Runs the transactions against a new test file, with records of record_size
+// bytes starting record_offset bytes after page 0, and reports on them.
+WorkloadResult run_workload(const std::string& working_directory)
+{
+    fprintf(stderr, "Records are %zu bytes at offset %zu.\n", record_size, record_offset);
+    if (header_entry_stride != sizeof(header_entry))
+        fprintf(stderr, "Header entries are %zu bytes apart, filling %zu bytes.\n", header_entry_stride, header_region_size(header_entry_stride));
+    if (record_size % geometry.physical_sector_size || record_offset % geometry.physical_sector_size)
+        fprintf(stderr, "Records are not aligned to the physical sector size, so writing them needs a read-modify-write.\n");
 
-    auto writer = writer_factory(working_directory, test_file_name);
+    // verify assumes 4096-byte records unless the file name says otherwise.
+    std::string description = strategy_description;
+    if (record_size != 4096)
+        description += "-r" + std::to_string(record_size);
+    if (record_offset)
+        description += "-o" + std::to_string(record_offset);
 
     // Simulate a series of transactional writes to the file.
-    // The file size is increased by 16 pages after every 128 writes.
-    // The 128 writes correspond to updating each of the 16 new pages 8 times.
-    // Each write consists of writing a full page of data, followed by updating
+    // The file size is increased by 16 records after every 128 writes.
+    // The 128 writes correspond to updating each of the 16 new records 8 times.
+    // Each write consists of writing a full record of data, followed by updating
     // the index on page 0 to reflect the newly-written data.
-    const size_t file_page_count_increment = 16;
+    const size_t file_record_count_increment = 16;
     const size_t versions_per_file_size = 8;
 
-    for (size_t i = 0; i < 1024; ++i) {
-        size_t page_count = file_page_count_increment * (i + 1) + 1;
-        size_t file_size = page_count * PAGE_SIZE;
+    // Pool files are big enough to hold the test file, or the write-ahead log
+    // with a record for every transaction, at the end of the run.
+    header_layout = header_layout_factory();
+    if (file_pool_enabled) {
+        size_t record_count = file_record_count_increment * extension_count;
+        file_pool.reset(new FilePool(working_directory + "/pool"));
+        file_pool->setFileSize(".dat", header_region_size(header_entry_stride) + record_offset
+            + header_layout->reservedBytes(record_count) + record_count * record_size);
+        file_pool->setFileSize(".wal", record_count * versions_per_file_size * wal_record_size(record_size));
+    }
+
+    WorkloadResult result;
+    result.test_file_name = "test-" + run_name() + "-" + description + ".dat";
+    result.record_size = record_size;
+    result.record_offset = record_offset;
+    fprintf(stderr, "Test file: %s\n", result.test_file_name.c_str());
+    fprintf(stderr, "Seed: %llu\n", (unsigned long long)workload_seed);
+    write_manifest(working_directory, result.test_file_name, description, file_record_count_increment, versions_per_file_size);
+    fprintf(stderr, "Write syncs: %s\n", sync_primitives(write_sync_strategies).c_str());
+    fprintf(stderr, "Extend syncs: %s\n", sync_primitives(extend_sync_strategies).c_str());
+
+    for (auto* st : coalescing_sync_strategies)
+        st->resetCounts();
+    if (emulated_device)
+        emulated_device->resetCounts();
+    auto protocol = protocol_factory(working_directory, result.test_file_name);
+    DeviceStatistics device_statistics(working_directory);
+    DeviceStatistics::Sample device_sample_at_start = device_statistics.sample();
+    long long application_bytes = 0;
+
+    // Commits shortly after a snapshot show the cost of breaking up extents the snapshot shares.
+    const size_t commits_affected_by_snapshot = 16;
+
+    LatencyStats commit_latency;
+    LatencyStats total_commit_latency;
+    LatencyStats snapshot_latency;
+    LatencyStats commit_after_snapshot_latency;
+    LatencyStats total_phase_latency[phase_count];
+    IOCounters total_phase_counters[phase_count];
+    size_t transaction_count = 0;
+    size_t commits_since_snapshot = commits_affected_by_snapshot;
+    // The header entry each transaction updates, in each round of versions.
+    std::vector<size_t> commit_order(file_record_count_increment * versions_per_file_size);
+    std::mt19937_64 random(workload_seed);
+    size_t extension = 0;
+    // Commits every version of the records in the current extension of the file
+    // whose header entries belong to the writer.
+    auto commit_records = [&](size_t writer, size_t base_offset, std::vector<char>& record_buffer, LatencyStats& latency, long long& bytes) {
+        for (size_t j = 0; j < file_record_count_increment * versions_per_file_size; ++j) {
+            size_t index = commit_order[j];
+            if (index % writer_count != writer)
+                continue;
+            size_t version = j / file_record_count_increment;
+            struct { size_t a, b; } pattern = { index, version };
+            memset_pattern16(record_buffer.data(), &pattern, record_size);
+            header_entry header = { base_offset, index, version, header_entry_marker };
+
+            auto start = std::chrono::steady_clock::now();
+            protocol->commit(index, record_buffer.data(), header);
+            auto commit_duration = std::chrono::steady_clock::now() - start;
+            latency.record(commit_duration);
+            if (ack_log) {
+                long long now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                fprintf(ack_log, "%s %zu %lld\n", result.test_file_name.c_str(), extension * commit_order.size() + j + 1, now);
+            }
+            bytes += record_size + sizeof(header);
+            if (commits_since_snapshot < commits_affected_by_snapshot) {
+                ++commits_since_snapshot;
+                commit_after_snapshot_latency.record(commit_duration);
+            }
+
+            if (snapshotter && !(++transaction_count % snapshot_interval)) {
+                protocol->forEachFile([&](const WriteStrategy& writer) {
+                    auto start = std::chrono::steady_clock::now();
+                    const char* method = snapshotter->snapshot(writer);
+                    auto duration = std::chrono::steady_clock::now() - start;
+                    snapshot_latency.record(duration);
+                    fprintf(stderr, "Snapshot of %s (%zu bytes) using %s took %.3fms.\n", writer.fileName().c_str(), writer.length(), method,
+                        std::chrono::duration<double, std::milli>(duration).count());
+                });
+                commits_since_snapshot = 0;
+            }
+
+            std::this_thread::sleep_for(transaction_delay);
+        }
+    };
+
+    // With several writers, each runs on its own thread and the file is only
+    // extended while all of them wait between extensions.
+    size_t base_offset = 0;
+    bool writers_running = true;
+    Barrier extension_start(writer_count + 1);
+    Barrier extension_end(writer_count + 1);
+    std::vector<LatencyStats> writer_latency(writer_count);
+    std::vector<LatencyStats> total_writer_latency(writer_count);
+    std::vector<long long> writer_bytes(writer_count);
+    std::vector<std::thread> writer_threads;
+    for (size_t writer = 0; writer < writer_count && writer_count > 1; ++writer) {
+        writer_threads.emplace_back([&, writer] {
+            std::vector<char> record_buffer(record_size);
+            for (;;) {
+                extension_start.wait();
+                if (!writers_running)
+                    return;
+                commit_records(writer, base_offset, record_buffer, writer_latency[writer], writer_bytes[writer]);
+                extension_end.wait();
+            }
+        });
+    }
+
+    // With a duration, the file keeps being extended until it has passed, or
+    // until the header layout cannot hold the records of another extension.
+    auto deadline = std::chrono::steady_clock::now() + run_duration;
+    auto more_extensions = [&](size_t i) {
+        if (!run_duration.count())
+            return i < extension_count;
+        if ((i + 1) * file_record_count_increment > header_layout->recordCapacity()) {
+            fprintf(stderr, "\nThe header layout is full, so the run ends early.\n");
+            return false;
+        }
+        return std::chrono::steady_clock::now() < deadline;
+    };
+
+    std::vector<char> record_buffer(record_size);
+    std::chrono::steady_clock::duration commit_wall_time(0);
+    size_t file_size = header_region_size(header_entry_stride) + record_offset;
+    for (size_t i = 0; more_extensions(i); ++i) {
+        // The header layout can place index pages ahead of each extension's records.
+        size_t records_offset = file_size + header_layout->reserve(file_size, file_record_count_increment);
+        file_size = records_offset + file_record_count_increment * record_size;
         if (i > 0)
             fputc('\n', stderr);
 
         fprintf(stderr, "Truncating file to %zu bytes.\n", file_size);
-        writer->extend(file_size);
-        writer->sync(extend_sync_strategies);
-
-        size_t base_offset = (page_count - file_page_count_increment) * PAGE_SIZE;
-        for (size_t j = 0; j < file_page_count_increment * versions_per_file_size; ++j) {
-            char page_buffer[PAGE_SIZE];
-
-            // Simulate updating the data portion of the file.
-            size_t index = j % file_page_count_increment;
-            size_t version = j / file_page_count_increment;
-            size_t offset = base_offset + index * PAGE_SIZE;
-            fprintf(stderr, "Writing index %zu, version %zu at offset %zu...", index, version, offset);
-            struct { size_t a, b; } pattern = { index, version };
-            memset_pattern16(page_buffer, &pattern, PAGE_SIZE);
-            writer->write(offset, page_buffer, PAGE_SIZE);
+        protocol->extend(file_size);
 
-            writer->sync(write_sync_strategies);
-            fprintf(stderr, " done!\n");
+        base_offset = records_offset;
+        extension = i;
+        for (size_t j = 0; j < commit_order.size(); ++j)
+            commit_order[j] = j % file_record_count_increment;
+        for (size_t version = 0; random_order && version < versions_per_file_size; ++version)
+            shuffle_entries(&commit_order[version * file_record_count_increment], file_record_count_increment, random);
+        if (writer_count == 1) {
+            commit_records(0, base_offset, record_buffer, commit_latency, application_bytes);
+        } else {
+            auto start = std::chrono::steady_clock::now();
+            extension_start.wait();
+            extension_end.wait();
+            auto duration = std::chrono::steady_clock::now() - start;
+            commit_wall_time += duration;
 
-            // Simulate updating the header portion of the file.
-            fprintf(stderr, "Updating header portion of file...");
-            struct { size_t a, b, c, d; } header = { base_offset, index, version, std::numeric_limits<size_t>::max() };
-            writer->write(index * sizeof(header), &header, sizeof(header));
-            writer->sync(write_sync_strategies);
-            fprintf(stderr, " done!\n");
+            for (size_t writer = 0; writer < writer_count; ++writer) {
+                commit_latency.merge(writer_latency[writer]);
+                total_writer_latency[writer].merge(writer_latency[writer]);
+                writer_latency[writer].clear();
+                application_bytes += writer_bytes[writer];
+                writer_bytes[writer] = 0;
+            }
+            fprintf(stderr, "%zu writers made %zu commits in %.3fs (%.1f/s).\n", writer_count, commit_latency.count(),
+                std::chrono::duration<double>(duration).count(), commit_latency.count() / std::chrono::duration<double>(duration).count());
+        }
+
+        commit_latency.report("Commits");
+        total_commit_latency.merge(commit_latency);
+        commit_latency.clear();
+        for (size_t phase = 0; phase < phase_count; ++phase) {
+            phase_latency[phase].report(phase_names[phase]);
+            total_phase_latency[phase].merge(phase_latency[phase]);
+            phase_latency[phase].clear();
+        }
+        device_statistics.report(device_sample_at_start, device_statistics.sample(), application_bytes, "Device writes so far");
+        if (io_counters_enabled) {
+            for (size_t phase = 0; phase < phase_count; ++phase) {
+                phase_counters[phase].report(phase_names[phase]);
+                total_phase_counters[phase].add(phase_counters[phase]);
+                phase_counters[phase] = IOCounters();
+            }
+        }
+    }
+
+    if (!writer_threads.empty()) {
+        writers_running = false;
+        extension_start.wait();
+    }
+    for (auto& thread : writer_threads)
+        thread.join();
+
+    fputc('\n', stderr);
+    total_commit_latency.report("All commits");
+    if (writer_count > 1) {
+        double seconds = std::chrono::duration<double>(commit_wall_time).count();
+        fprintf(stderr, "%zu writers made %zu commits in %.3fs (%.1f/s).\n", writer_count, total_commit_latency.count(), seconds,
+            total_commit_latency.count() / seconds);
+        for (size_t writer = 0; writer < writer_count; ++writer)
+            total_writer_latency[writer].report(("Writer " + std::to_string(writer) + " commits").c_str());
+    }
+    for (size_t phase = 0; phase < phase_count; ++phase)
+        total_phase_latency[phase].report(phase_names[phase]);
+    device_statistics.report(device_sample_at_start, device_statistics.sample(), application_bytes, description.c_str());
+    if (io_counters_enabled) {
+        fprintf(stderr, "I/O counters for %s:\n", description.c_str());
+        for (size_t phase = 0; phase < phase_count; ++phase)
+            total_phase_counters[phase].report(phase_names[phase]);
+    }
+    for (auto* st : coalescing_sync_strategies)
+        st->report(total_commit_latency.count());
+    commit_after_snapshot_latency.report("Commits after a snapshot");
+    snapshot_latency.report("Snapshots");
+    fprintf(stderr, "Write syncs used: %s\n", sync_primitives(write_sync_strategies).c_str());
+    fprintf(stderr, "Extend syncs used: %s\n", sync_primitives(extend_sync_strategies).c_str());
+
+    // Closing the files loses whatever a volatile cache still holds.
+    if (emulated_device) {
+        protocol.reset();
+        emulated_device->report();
+    }
+
+    result.commit_latency = total_commit_latency;
+    result.application_bytes = application_bytes;
+    return result;
+}
+
+// Runs jobs on a fixed number of threads. Jobs are dealt out to a queue per
+// thread; each thread takes jobs from the front of its own queue and, once it
+// is empty, steals from the back of the others, so that a thread that drew
+// short experiments does not sit idle while another still has a backlog.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t thread_count)
+        : m_queues(thread_count)
+        , m_next_queue(0)
+    {}
+
+    // Jobs must all be submitted before run is called.
+    void submit(std::function<void()> job)
+    {
+        m_queues[m_next_queue++ % m_queues.size()].jobs.push_back(std::move(job));
+    }
+
+    // Runs every submitted job, returning once they have all completed.
+    void run()
+    {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < m_queues.size(); ++i) {
+            threads.emplace_back([this, i] {
+                std::function<void()> job;
+                while (take(i, job))
+                    job();
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> jobs;
+    };
+
+    bool take(size_t index, std::function<void()>& job)
+    {
+        for (size_t i = 0; i < m_queues.size(); ++i) {
+            Queue& queue = m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty())
+                continue;
+            if (!i) {
+                job = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+            } else {
+                job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<Queue> m_queues;
+    size_t m_next_queue;
+};
+
+// Each line of an experiments file holds the options and arguments of one run
+// of main, e.g. "--duration=60 --delay=0 write fsync none". Blank lines and
+// lines starting with '#' are skipped.
+std::vector<std::vector<std::string>> read_experiments(const std::string& file_name)
+{
+    FILE* file = fopen(file_name.c_str(), "r");
+    ensure(file);
+    std::vector<std::vector<std::string>> experiments;
+    char* line = nullptr;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, file) != -1) {
+        std::vector<std::string> arguments;
+        char* context;
+        for (const char* argument = strtok_r(line, " \t\r\n", &context); argument; argument = strtok_r(nullptr, " \t\r\n", &context))
+            arguments.push_back(argument);
+        if (!arguments.empty() && arguments.front()[0] != '#')
+            experiments.push_back(arguments);
+    }
+    free(line);
+    fclose(file);
+    return experiments;
+}
+
+// Runs an experiment as a child process with its output going to a log file,
+// and returns its wait status. Every run has options and I/O counters of its
+// own, which a process each keeps apart.
+int run_experiment(const char* program, const std::vector<std::string>& experiment, const std::string& summary_file_name, const std::string& log_file_name)
+{
+    std::string summary_argument = "--summary=" + summary_file_name;
+    std::vector<char*> arguments = { const_cast<char*>(program), const_cast<char*>(summary_argument.c_str()) };
+    for (const auto& argument : experiment)
+        arguments.push_back(const_cast<char*>(argument.c_str()));
+    arguments.push_back(nullptr);
+
+    // Only async-signal-safe calls may be made between fork and exec, since other threads hold locks.
+    pid_t pid = fork();
+    ensure(pid != -1);
+    if (!pid) {
+        int log_fd = open(log_file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (log_fd == -1 || dup2(log_fd, STDERR_FILENO) == -1)
+            _exit(127);
+        execv(program, arguments.data());
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1)
+        ensure(errno == EINTR);
+    return status;
+}
+
+// Returns the arguments of an experiment without any --working option, which
+// the scheduler replaces with the directory it runs the experiment in.
+std::vector<std::string> without_working_option(const std::vector<std::string>& arguments)
+{
+    std::vector<std::string> result;
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        if (arguments[i] == "--working")
+            ++i;
+        else if (arguments[i].compare(0, 10, "--working="))
+            result.push_back(arguments[i]);
+    }
+    return result;
+}
+
+// Runs every experiment in every working directory on work-stealing pools,
+// collecting the rows of results in a summary CSV file in the first directory
+// and printing the directories' results side by side. Each device holding a
+// working directory has a pool of workers_per_device threads, or just one with
+// isolate_experiments so that experiments do not compete for the device.
+int run_experiments(const char* program, const std::vector<std::vector<std::string>>& experiments)
+{
+    struct Job {
+        size_t experiment;
+        size_t directory;
+        dev_t device;
+        std::string log_file_name;
+        std::string results_file_name;
+    };
+
+    std::string timestamp = current_timestamp();
+    std::vector<Job> jobs;
+    std::unordered_map<dev_t, std::unique_ptr<WorkStealingPool>> pools;
+    size_t thread_count = isolate_experiments ? 1 : workers_per_device;
+    for (size_t directory = 0; directory < working_directories.size(); ++directory) {
+        struct stat st;
+        if (stat(working_directories[directory].c_str(), &st)) {
+            perror("stat");
+            return 1;
+        }
+        std::unique_ptr<WorkStealingPool>& pool = pools[st.st_dev];
+        if (!pool)
+            pool.reset(new WorkStealingPool(thread_count));
+        for (size_t experiment = 0; experiment < experiments.size(); ++experiment) {
+            std::string base_name = working_directories[directory] + "/experiment-" + timestamp + "-" + std::to_string(experiment + 1);
+            jobs.push_back({ experiment, directory, st.st_dev, base_name + ".log", base_name + ".csv" });
+        }
+    }
+    fprintf(stderr, "Running %zu experiments in %zu directories on %zu devices, %zu at a time on each.\n", experiments.size(),
+        working_directories.size(), pools.size(), thread_count);
+
+    std::mutex report_mutex;
+    size_t failure_count = 0;
+    for (const Job& job : jobs) {
+        pools[job.device]->submit([&] {
+            std::string description;
+            for (const auto& argument : experiments[job.experiment])
+                description += (description.empty() ? "" : " ") + argument;
+
+            std::vector<std::string> arguments = without_working_option(experiments[job.experiment]);
+            arguments.insert(arguments.begin(), "--working=" + working_directories[job.directory]);
+            auto start = std::chrono::steady_clock::now();
+            int status = run_experiment(program, arguments, job.results_file_name, job.log_file_name);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(report_mutex);
+            bool succeeded = WIFEXITED(status) && !WEXITSTATUS(status);
+            if (!succeeded)
+                ++failure_count;
+            fprintf(stderr, "Experiment %zu (%s) in %s %s after %.1fs, log: %s\n", job.experiment + 1, description.c_str(),
+                working_directories[job.directory].c_str(), succeeded ? "completed" : "failed", seconds, job.log_file_name.c_str());
+        });
+    }
+
+    // Devices run their experiments in parallel with each other.
+    std::vector<std::thread> pool_threads;
+    for (auto& pool : pools)
+        pool_threads.emplace_back([&pool] { pool.second->run(); });
+    for (auto& thread : pool_threads)
+        thread.join();
+
+    // Each row is keyed by its experiment, record size and offset, with a cell of results for each directory.
+    std::string summary_file_name = working_directories.front() + "/experiments-" + timestamp + ".csv";
+    FILE* summary = fopen(summary_file_name.c_str(), "w");
+    if (!summary) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(summary, "experiment,working_directory,%s\n", result_csv_header);
+    std::map<std::tuple<size_t, size_t, size_t>, std::vector<std::string>> comparison;
+    for (const Job& job : jobs) {
+        FILE* results = fopen(job.results_file_name.c_str(), "r");
+        if (!results)
+            continue;
+        char* line = nullptr;
+        size_t line_capacity = 0;
+        while (getline(&line, &line_capacity, results) != -1) {
+            fprintf(summary, "%zu,%s,%s", job.experiment + 1, working_directories[job.directory].c_str(), line);
+            size_t size, offset;
+            double commits_per_second, p99;
+            if (sscanf(line, "%zu,%zu,%*u,%*f,%lf,%*f,%*f,%*f,%lf", &size, &offset, &commits_per_second, &p99) != 4)
+                continue;
+            std::vector<std::string>& cells = comparison[std::make_tuple(job.experiment, size, offset)];
+            cells.resize(working_directories.size(), "-");
+            char cell[64];
+            snprintf(cell, sizeof(cell), "%.1f/s p99 %.0fus", commits_per_second, p99);
+            cells[job.directory] = cell;
+        }
+        free(line);
+        fclose(results);
+        unlink(job.results_file_name.c_str());
+    }
+    fclose(summary);
+
+    fprintf(stderr, "\nCommits per second and p99 commit latency:\n%-28s", "experiment, record@offset");
+    for (const auto& directory : working_directories)
+        fprintf(stderr, "  %-24s", directory.c_str());
+    fputc('\n', stderr);
+    for (const auto& row : comparison) {
+        std::string label = std::to_string(std::get<0>(row.first) + 1) + ", " + std::to_string(std::get<1>(row.first)) + "@" + std::to_string(std::get<2>(row.first));
+        fprintf(stderr, "%-28s", label.c_str());
+        for (const auto& cell : row.second)
+            fprintf(stderr, "  %-24s", cell.c_str());
+        fputc('\n', stderr);
+    }
+
+    fprintf(stderr, "\n%zu of %zu experiments completed. Results: %s\n", jobs.size() - failure_count, jobs.size(), summary_file_name.c_str());
+    return failure_count ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    for (int i = 0; i < argc; ++i)
+        command_line += (i ? " " : "") + std::string(argv[i]);
+
+    try {
+        initialize_from_arguments(argc, argv);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "Usage: main [options] [mmap|write|write-dsync|write-hipri|write-dsync-hipri|replace|replace-exchange|emulated|emulated-dsync] write-sync-strategy-list extend-sync-strategy-list\n"
+                        "Options:\n"
+                        "  --header=inplace|ab|radix [--entry-spacing=packed|cacheline|sector|page]\n"
+                        "  --protocol=inplace|wal|shadow\n"
+                        "  --delay=ms\n"
+                        "  --snapshot-every=n [--snapshot=auto|clone|copy-range|stream]\n"
+                        "  --mmap-populate\n"
+                        "  --mmap-advice=hugepage,sequential,random,willneed,populate-write\n"
+                        "  --counters\n"
+                        "  --file-pool\n"
+                        "  --record-size=bytes|page|fsblock|lsector|psector[*n|/n] --record-offset=bytes\n"
+                        "  --extensions=n\n"
+                        "  --sweep-sizes=size,... --sweep-offsets=bytes,...\n"
+                        "  --writers=n [--coalesce-syncs]\n"
+                        "  --duration=seconds\n"
+                        "  --summary=file\n"
+                        "  --seed=n --random-order\n"
+                        "  --ack-log=file|-\n"
+                        "  --working=directory,...\n"
+                        "  --device=hdd|sata-ssd|nvme|nvme-plp[,cache=bytes,write-us=n,flush-us=n,mbps=n,fua=0|1,volatile=0|1]\n"
+                        "Usage: main --experiments=file [--jobs-per-device=n] [--isolate] [--working=directory,...]\n");
+        return 1;
+    }
+
+    for (const auto& directory : working_directories) {
+        if (mkdir(directory.c_str(), 0777) && errno != EEXIST) {
+            perror("mkdir");
+            return 1;
+        }
+    }
+
+    // With several working directories, the arguments are run as an experiment in each of them.
+    if (!experiments_file_name.empty() || working_directories.size() > 1) {
+        std::vector<std::vector<std::string>> experiments;
+        if (experiments_file_name.empty()) {
+            experiments.push_back(std::vector<std::string>(argv + 1, argv + argc));
+        } else {
+            try {
+                experiments = read_experiments(experiments_file_name);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Cannot read %s: %s\n", experiments_file_name.c_str(), e.what());
+                return 1;
+            }
+        }
+        return run_experiments(argv[0], experiments);
+    }
+
+    std::string working_directory = working_directories.front();
+    if (snapshotter) {
+        try {
+            snapshotter->probe(working_directory);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            fprintf(stderr, "Use --snapshot=auto to fall back to a method the filesystem supports.\n");
+            return 1;
+        }
+    }
+    geometry = Geometry::detect(working_directory);
+    geometry.report();
+
+    // Every combination of record size and offset in a sweep is run against
+    // its own test file, with a row of results in a CSV file.
+    bool sweep = !sweep_sizes_string.empty() || !sweep_offsets_string.empty();
+    std::vector<size_t> record_sizes;
+    std::vector<size_t> record_offsets;
+    try {
+        for (const auto& size : split_list(sweep_sizes_string.empty() ? record_size_string : sweep_sizes_string))
+            record_sizes.push_back(record_size_from_string(size, geometry));
+        if (sweep_offsets_string.empty())
+            record_offsets.push_back(record_offset);
+        for (const auto& offset : sweep_offsets_string.empty() ? std::vector<std::string>() : split_list(sweep_offsets_string))
+            record_offsets.push_back(std::stoul(offset));
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Invalid record size or offset: %s\n", e.what());
+        return 1;
+    }
+
+    // The scheduler collects the results of the runs it starts from a summary file.
+    FILE* summary = nullptr;
+    if (!summary_file_name.empty()) {
+        summary = fopen(summary_file_name.c_str(), "a");
+        if (!summary) {
+            perror("fopen");
+            return 1;
+        }
+    }
+
+    // A run that fails part way leaves its test file in place for verify.
+    try {
+        if (!sweep) {
+            record_size = record_sizes.front();
+            WorkloadResult result = run_workload(working_directory);
+            if (summary)
+                write_result_row(summary, result);
+            return 0;
+        }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::string csv_file_name = working_directory + "/sweep-" + current_timestamp() + "-" + strategy_description + ".csv";
+        FILE* csv = fopen(csv_file_name.c_str(), "w");
+        if (!csv) {
+            perror("fopen");
+            return 1;
+        }
+        fprintf(csv, "%s\n", result_csv_header);
+        for (size_t size : record_sizes) {
+            for (size_t offset : record_offsets) {
+                record_size = size;
+                record_offset = offset;
+                fprintf(stderr, "\n==> Record size %zu, offset %zu <==\n", record_size, record_offset);
+                WorkloadResult result = run_workload(working_directory);
+                write_result_row(csv, result);
+                if (summary)
+                    write_result_row(summary, result);
+            }
         }
+        fclose(csv);
+        fprintf(stderr, "\nSweep results: %s\n", csv_file_name.c_str());
+        return 0;
+    } catch (const std::exception& e) {
+        fprintf(stderr, "\nRun failed: %s\n", e.what());
+        return 1;
     }
-    return 0;
 }
@@ -0,0 +1,20 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// Fills in what OS X provides and Linux does not, so that main builds on
+// both.
+
+#include <cstddef>
+#include <cstring>
+
+#ifndef __APPLE__
+// Fills a buffer with copies of a 16-byte pattern, as OS X's libc does.
+inline void memset_pattern16(void* buffer, const void* pattern, size_t length)
+{
+    char* bytes = static_cast<char*>(buffer);
+    for (size_t offset = 0; offset < length; offset += 16)
+        memcpy(bytes + offset, pattern, length - offset < 16 ? length - offset : 16);
+}
+#endif
+
+#endif // PLATFORM_H
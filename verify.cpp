@@ -1,61 +1,578 @@
-#include <mach/vm_param.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
 #include <fcntl.h>
+#include <getopt.h>
+#include <map>
 #include <stdio.h>
 #include <string>
-#include <sys/errno.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <vector>
+
+#include "format.h"
 
 struct page_entry { size_t index, version; };
 
-int main(int argc, char** argv)
+// A power loss can tear a record write at sector boundaries. Each record is
+// examined one sector at a time so that tears can be told apart from records
+// that were simply never written, and so that we can see whether the storage
+// provides atomic writes at the larger block granularity. Sectors are aligned
+// to the file rather than to the record, so a record at an unaligned offset
+// starts and ends part way through a sector. The sizes can be set to match the
+// device under test, and the record size to match the file when its name does
+// not give it.
+static size_t sector_size = 512;
+static size_t atomic_block_size = 4096;
+static size_t record_size_override = 0;
+static const size_t default_record_size = 4096;
+
+enum sector_state { sector_old, sector_new, sector_zero, sector_stale, sector_garbage, sector_state_count };
+static const char* const sector_state_names[sector_state_count] = { "old", "new", "zero", "stale", "garbage" };
+static const char sector_state_symbols[sector_state_count] = { 'o', 'n', 'z', 's', 'g' };
+
+struct torn_write_summary {
+    size_t records = 0;
+    size_t torn_records = 0;
+    size_t torn_within_atomic_block = 0;
+    size_t sectors[sector_state_count] = {};
+    // The data lost by files whose acknowledgements were logged, the recovery
+    // point objective of the strategy being the worst of them.
+    size_t acknowledged_files = 0;
+    size_t max_lost_transactions = 0;
+    size_t max_lost_bytes = 0;
+    double max_lost_seconds = 0;
+    size_t out_of_order_files = 0;
+};
+
+// The time in microseconds at which main acknowledged each transaction, by
+// transaction number, for each test file named in the --acks log.
+static std::map<std::string, std::map<size_t, long long>> acknowledgements;
+
+// Whether bytes [begin, end) of a record hold the 16-byte pattern repeated from
+// the start of the record.
+bool matches_pattern(const char* record, size_t begin, size_t end, const page_entry& pattern)
+{
+    const char* bytes = (const char*)&pattern;
+    for (size_t i = begin; i < end; ++i) {
+        if (record[i] != bytes[i % sizeof(pattern)])
+            return false;
+    }
+    return true;
+}
+
+// Classifies bytes [begin, end) of a record whose header entry claims
+// { index, version }. "old" is the version the header refers to, "new" is the
+// version the writer would have been writing when it was interrupted.
+sector_state classify_sector(const char* record, size_t begin, size_t end, size_t index, size_t version)
+{
+    page_entry old_pattern = { index, version };
+    page_entry new_pattern = { index, version + 1 };
+    page_entry zero_pattern = { 0, 0 };
+    if (matches_pattern(record, begin, end, old_pattern))
+        return sector_old;
+    if (matches_pattern(record, begin, end, new_pattern))
+        return sector_new;
+    if (matches_pattern(record, begin, end, zero_pattern))
+        return sector_zero;
+
+    size_t first_pattern = (begin + sizeof(page_entry) - 1) / sizeof(page_entry) * sizeof(page_entry);
+    if (first_pattern + sizeof(page_entry) <= end) {
+        page_entry pattern = *(const page_entry*)(record + first_pattern);
+        if (pattern.index == index && matches_pattern(record, begin, end, pattern))
+            return sector_stale;
+    }
+    return sector_garbage;
+}
+
+// Test files are named test-<timestamp>.<pid>-<write strategy>-<write sync>-<extend sync>.dat.
+// The strategy portion is used to group results when several files are verified at once.
+std::string strategy_from_file_name(const std::string& file_name)
+{
+    std::string name = file_name.substr(file_name.find_last_of('/') + 1);
+    const std::string prefix = "test-", suffix = ".dat";
+    if (name.compare(0, prefix.size(), prefix) || name.size() < prefix.size() + suffix.size()
+        || name.compare(name.size() - suffix.size(), suffix.size(), suffix))
+        return "unknown";
+
+    name = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+    size_t position = 0;
+    for (size_t field = 0; field < 6 && position != std::string::npos; ++field) {
+        position = name.find('-', position);
+        if (position != std::string::npos)
+            ++position;
+    }
+    if (position == std::string::npos)
+        return "unknown";
+    return name.substr(position);
+}
+
+// main adds -r<bytes> to the names of files whose records are not 4096 bytes.
+size_t record_size_from_file_name(const std::string& file_name)
+{
+    std::string strategy = strategy_from_file_name(file_name);
+    for (size_t position = strategy.find("-r"); position != std::string::npos; position = strategy.find("-r", position + 1)) {
+        size_t end = strategy.find_first_not_of("0123456789", position + 2);
+        if (end != position + 2 && (end == std::string::npos || strategy[end] == '-'))
+            return std::stoul(strategy.substr(position + 2, end - position - 2));
+    }
+    return default_record_size;
+}
+
+// Reads the name=value lines of the manifest main writes next to each test
+// file, returning false if there is none.
+bool read_manifest(const std::string& file_name, std::map<std::string, std::string>& manifest)
+{
+    FILE* file = fopen(manifest_file_name(file_name).c_str(), "r");
+    if (!file)
+        return false;
+    char* line = nullptr;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, file)) != -1) {
+        std::string entry(line, length && line[length - 1] == '\n' ? length - 1 : length);
+        size_t equals = entry.find('=');
+        if (equals != std::string::npos)
+            manifest[entry.substr(0, equals)] = entry.substr(equals + 1);
+    }
+    free(line);
+    fclose(file);
+    return true;
+}
+
+bool read_acknowledgements(const char* file_name)
 {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: verify [filename]\n");
-        return 1;
+    FILE* file = fopen(file_name, "r");
+    if (!file) {
+        perror("fopen");
+        return false;
+    }
+    char name[PATH_MAX];
+    size_t transaction;
+    long long time;
+    while (fscanf(file, "%4095s %zu %lld", name, &transaction, &time) == 3)
+        acknowledgements[name][transaction] = time;
+    fclose(file);
+    return true;
+}
+
+// The order in which main committed transactions, regenerated from a manifest
+// so that the header entries in a file can be placed in it. Transactions are
+// numbered from 1. Each extension of the file adds records_per_extension
+// records, which are each updated versions_per_extension times in rounds, in
+// an order shuffled with the run's seed when random_order is set.
+class TransactionSchedule {
+public:
+    TransactionSchedule(std::map<std::string, std::string>& manifest, size_t record_size)
+        : m_record_size(record_size)
+        , m_record_offset(std::stoul(manifest["record_offset"]))
+        , m_entry_stride(manifest["entry_stride"].empty() ? sizeof(header_entry) : std::stoul(manifest["entry_stride"]))
+        , m_records(std::stoul(manifest["records_per_extension"]))
+        , m_versions(std::stoul(manifest["versions_per_extension"]))
+        , m_random_order(manifest["random_order"] == "1")
+        , m_random(std::stoull(manifest["seed"]))
+    {}
+
+    size_t transactionsPerExtension() const
+    {
+        return m_records * m_versions;
+    }
+
+    size_t recordsPerExtension() const
+    {
+        return m_records;
+    }
+
+    // Returns the extension of the file that holds the record an entry refers
+    // to, found from its offset, or SIZE_MAX if no extension starts there.
+    // Layouts with index pages among the records number them instead.
+    size_t extensionOf(const header_entry& entry) const
+    {
+        size_t first_offset = header_region_size(m_entry_stride) + m_record_offset;
+        size_t extension_size = m_records * m_record_size;
+        if (entry.offset < first_offset || (entry.offset - first_offset) % extension_size)
+            return SIZE_MAX;
+        return (entry.offset - first_offset) / extension_size;
     }
 
-    std::string file_name = argv[1];
+    // Returns the number of the transaction that wrote the entry to a record in
+    // the given extension, or 0 if the schedule has no such transaction.
+    size_t transactionNumber(size_t extension, const header_entry& entry)
+    {
+        if (extension == SIZE_MAX || entry.index >= m_records || entry.version >= m_versions)
+            return 0;
+        const std::vector<size_t>& order = orderOf(extension);
+        for (size_t j = entry.version * m_records; j < (entry.version + 1) * m_records; ++j) {
+            if (order[j] == entry.index)
+                return extension * order.size() + j + 1;
+        }
+        return 0;
+    }
+
+    // Returns the index of the record that the given transaction updated.
+    size_t indexOf(size_t transaction)
+    {
+        size_t transactions_per_extension = m_records * m_versions;
+        return orderOf((transaction - 1) / transactions_per_extension)[(transaction - 1) % transactions_per_extension];
+    }
+
+    // Returns the last transaction after first and up to and including the
+    // given one that updated a record with the given index, or 0 if there is none.
+    size_t lastTransactionFor(size_t index, size_t transaction, size_t first = 0)
+    {
+        size_t transactions_per_extension = m_records * m_versions;
+        for (; transaction > first; --transaction) {
+            if (orderOf((transaction - 1) / transactions_per_extension)[(transaction - 1) % transactions_per_extension] == index)
+                return transaction;
+        }
+        return 0;
+    }
+
+private:
+    // The random generator is shared between extensions, so their orders are generated in turn.
+    const std::vector<size_t>& orderOf(size_t extension)
+    {
+        while (m_orders.size() <= extension) {
+            std::vector<size_t> order(m_records * m_versions);
+            for (size_t j = 0; j < order.size(); ++j)
+                order[j] = j % m_records;
+            for (size_t version = 0; m_random_order && version < m_versions; ++version)
+                shuffle_entries(&order[version * m_records], m_records, m_random);
+            m_orders.push_back(order);
+        }
+        return m_orders[extension];
+    }
+
+    size_t m_record_size;
+    size_t m_record_offset;
+    size_t m_entry_stride;
+    size_t m_records;
+    size_t m_versions;
+    bool m_random_order;
+    std::mt19937_64 m_random;
+    std::vector<std::vector<size_t>> m_orders;
+};
+
+// Finds the last transaction whose effects the file holds, its recovery point,
+// and from the acknowledgements main logged, how many acknowledged transactions
+// were lost and over how long a window before the last acknowledgement.
+// Several writers commit the records they own in any interleaving with each
+// other, so each writer has its own recovery point.
+void report_recovery_point(std::map<std::string, std::string>& manifest, size_t record_size, const std::vector<header_entry>& entries,
+    bool every_record, torn_write_summary& summary)
+{
+    TransactionSchedule schedule(manifest, record_size);
+    size_t records_per_extension = schedule.recordsPerExtension();
+    size_t writer_count = manifest["writers"].empty() ? 1 : std::stoul(manifest["writers"]);
+    std::vector<size_t> numbers(entries.size());
+    std::vector<size_t> recovered(writer_count);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].marker != header_entry_marker)
+            continue;
+        size_t extension = every_record ? i / records_per_extension : schedule.extensionOf(entries[i]);
+        numbers[i] = schedule.transactionNumber(extension, entries[i]);
+        size_t& writer_recovered = recovered[i % records_per_extension % writer_count];
+        writer_recovered = std::max(writer_recovered, numbers[i]);
+    }
+    if (writer_count == 1)
+        fprintf(stderr, "Recovery point: transaction %zu.\n", recovered[0]);
+    else {
+        fprintf(stderr, "Recovery points:");
+        for (size_t writer = 0; writer < writer_count; ++writer)
+            fprintf(stderr, "%s writer %zu transaction %zu", writer ? "," : "", writer, recovered[writer]);
+        fprintf(stderr, ".\n");
+    }
+
+    // Each header entry should hold the last transaction that updated its
+    // record by its writer's recovery point, unless later writes reached the
+    // disk first. With an entry for every record, only the record's own
+    // extension counts.
+    bool out_of_order = false;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        size_t writer_recovered = recovered[i % records_per_extension % writer_count];
+        size_t expected;
+        if (every_record) {
+            size_t extension = i / records_per_extension;
+            size_t first = extension * schedule.transactionsPerExtension();
+            expected = schedule.lastTransactionFor(i % records_per_extension, std::min(writer_recovered, first + schedule.transactionsPerExtension()), first);
+        } else
+            expected = schedule.lastTransactionFor(i, writer_recovered);
+        if (numbers[i] >= expected)
+            continue;
+        fprintf(stderr, "Entry %zu holds transaction %zu, but transaction %zu had updated it by the recovery point.\n", i, numbers[i], expected);
+        out_of_order = true;
+    }
+    if (out_of_order)
+        ++summary.out_of_order_files;
+
+    auto acks = acknowledgements.find(manifest["file"]);
+    if (acks == acknowledgements.end()) {
+        fprintf(stderr, "No acknowledgements were logged for %s.\n\n", manifest["file"].c_str());
+        return;
+    }
+
+    // A transaction is lost if it follows its writer's recovery point. The
+    // window runs from the earliest acknowledgement of the recovery point of a
+    // writer that lost transactions, or of the first transaction if a writer
+    // recovered none, to the last acknowledgement.
+    const std::map<size_t, long long>& times = acks->second;
+    size_t lost = 0;
+    long long window_start = LLONG_MAX;
+    for (const auto& ack : times) {
+        size_t writer = schedule.indexOf(ack.first) % writer_count;
+        if (ack.first <= recovered[writer])
+            continue;
+        ++lost;
+        auto recovered_time = times.find(recovered[writer]);
+        window_start = std::min(window_start, recovered_time != times.end() ? recovered_time->second : times.begin()->second);
+    }
+    size_t lost_bytes = lost * (record_size + sizeof(header_entry));
+    double lost_seconds = lost ? (times.rbegin()->second - window_start) / 1e6 : 0;
+    fprintf(stderr, "Last acknowledged: transaction %zu. Lost %zu acknowledged transactions (%zu bytes) over %.3fs.\n\n", times.rbegin()->first,
+        lost, lost_bytes, lost_seconds);
+
+    ++summary.acknowledged_files;
+    summary.max_lost_transactions = std::max(summary.max_lost_transactions, lost);
+    summary.max_lost_bytes = std::max(summary.max_lost_bytes, lost_bytes);
+    summary.max_lost_seconds = std::max(summary.max_lost_seconds, lost_seconds);
+}
+
+bool read_file(const std::string& file_name, std::vector<char>& contents)
+{
     int fd = open(file_name.c_str(), O_RDONLY);
     if (fd == -1) {
         perror("open");
-        return 1;
+        return false;
     }
 
     struct stat st;
     if (fstat(fd, &st)) {
         perror("fstat");
-        return 1;
+        close(fd);
+        return false;
     }
 
-    size_t file_size = st.st_size;
-    fprintf(stderr, "File is %zu bytes in size.\n", file_size);
+    contents.resize(st.st_size);
+    size_t offset = 0;
+    while (offset < contents.size()) {
+        ssize_t count = pread(fd, contents.data() + offset, contents.size() - offset, offset);
+        if (count <= 0) {
+            perror("pread");
+            close(fd);
+            return false;
+        }
+        offset += count;
+    }
+    close(fd);
+    return true;
+}
 
-    char* base = (char*)mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (base == (char*)-1) {
-        perror("mmap");
-        return 1;
+// Copies the current header entries out of page 0, whichever layout was used to
+// write them, along with the byte offset of the record each entry refers to.
+// There are header_entry_count entries unless the radix layout was used, which
+// has an entry for every record in the file and sets every_record. The inplace
+// layout's entries are entry_stride bytes apart.
+bool read_header(const std::vector<char>& image, size_t record_size, size_t entry_stride, std::vector<header_entry>& entries,
+    std::vector<size_t>& page_offsets, bool& every_record)
+{
+    if (image.size() < header_page_size) {
+        fprintf(stderr, "File is too small to contain a header.\n");
+        return false;
     }
 
-    bool success = true;
-    char page_buffer[PAGE_SIZE];
+    const char* base = image.data();
+    const shadow_root* root = (const shadow_root*)base;
+    if (root->magic == shadow_root_magic) {
+        if (!shadow_root_is_valid(*root)) {
+            fprintf(stderr, "Shadow paging root is not valid!\n");
+            return false;
+        }
+        fprintf(stderr, "Shadow paging root has sequence %llu and refers to the table at byte offset %llu.\n",
+            (unsigned long long)root->sequence, (unsigned long long)root->table_offset);
+        if (root->table_offset + sizeof(shadow_table) > image.size()) {
+            fprintf(stderr, "Table offset is larger than file size!\n");
+            return false;
+        }
+        const shadow_table* table = (const shadow_table*)(base + root->table_offset);
+        if (checksum(table, sizeof(*table)) != root->table_checksum) {
+            fprintf(stderr, "Table does not match the checksum in the root!\n");
+            return false;
+        }
+        fputc('\n', stderr);
+        for (size_t i = 0; i < header_entry_count; ++i) {
+            entries[i] = table->entries[i];
+            page_offsets[i] = table->page_offsets[i];
+        }
+        return true;
+    }
+
+    const radix_root* radix = (const radix_root*)base;
+    if (radix->magic == radix_root_magic) {
+        if (radix->page_count > radix_root_capacity) {
+            fprintf(stderr, "Radix root refers to %llu index pages, more than it can hold!\n", (unsigned long long)radix->page_count);
+            return false;
+        }
+        fprintf(stderr, "Radix root refers to %llu index pages.\n\n", (unsigned long long)radix->page_count);
+        entries.assign(radix->page_count * index_page_entry_count, header_entry());
+        page_offsets.assign(entries.size(), 0);
+        for (size_t page = 0; page < radix->page_count; ++page) {
+            if (radix->pages[page] + index_page_size > image.size()) {
+                fprintf(stderr, "Index page %zu at byte offset %llu is past the end of the file!\n", page, (unsigned long long)radix->pages[page]);
+                continue;
+            }
+            memcpy(&entries[page * index_page_entry_count], base + radix->pages[page], index_page_size);
+        }
+        for (size_t i = 0; i < entries.size(); ++i)
+            page_offsets[i] = entries[i].offset + entries[i].index * record_size;
+        every_record = true;
+        return true;
+    }
+
+    const header_entry* header_entries = (const header_entry*)base;
+    const header_slot* slots[2] = { (const header_slot*)(base + header_slot_offset(0)), (const header_slot*)(base + header_slot_offset(1)) };
+    if (slots[0]->magic == header_slot_magic || slots[1]->magic == header_slot_magic) {
+        const header_slot* newest = nullptr;
+        for (size_t i = 0; i < 2; ++i) {
+            if (!header_slot_is_valid(*slots[i])) {
+                fprintf(stderr, "Header slot %zu is not valid (sequence %llu).\n", i, (unsigned long long)slots[i]->sequence);
+                continue;
+            }
+            fprintf(stderr, "Header slot %zu is valid with sequence %llu.\n", i, (unsigned long long)slots[i]->sequence);
+            if (!newest || slots[i]->sequence > newest->sequence)
+                newest = slots[i];
+        }
+        if (!newest) {
+            fprintf(stderr, "Neither header slot is valid!\n");
+            return false;
+        }
+        fprintf(stderr, "Using header slot with sequence %llu.\n\n", (unsigned long long)newest->sequence);
+        header_entries = newest->entries;
+    }
+
+    if (header_entries != (const header_entry*)base)
+        entry_stride = sizeof(header_entry);
+    else if (image.size() < header_region_size(entry_stride)) {
+        fprintf(stderr, "File is too small to contain header entries %zu bytes apart.\n", entry_stride);
+        return false;
+    }
+    for (size_t i = 0; i < header_entry_count; ++i) {
+        memcpy(&entries[i], (const char*)header_entries + i * entry_stride, sizeof(header_entry));
+        page_offsets[i] = entries[i].offset + entries[i].index * record_size;
+    }
+    return true;
+}
+
+// Applies every intact record in the write-ahead log to the file image and header
+// entries, as recovery would.
+void replay_log(const std::vector<char>& log, std::vector<char>& image, std::vector<header_entry>& entries, std::vector<size_t>& page_offsets)
+{
+    uint64_t sequence = 1;
+    size_t offset = 0;
+    const char* reason = "end of file";
+    for (; offset + sizeof(wal_record) <= log.size(); ++sequence) {
+        const wal_record* record = (const wal_record*)(log.data() + offset);
+        const char* data = log.data() + offset + sizeof(wal_record);
+        if (record->magic != wal_record_magic) {
+            reason = "no record";
+            break;
+        }
+        if (record->length > log.size() - offset - sizeof(wal_record)) {
+            reason = "record extends past end of file";
+            break;
+        }
+        if (record->sequence != sequence || record->checksum != wal_record_checksum(*record, data)) {
+            reason = "torn or corrupt record";
+            break;
+        }
+        if (record->slot >= header_entry_count) {
+            reason = "record for an invalid header entry";
+            break;
+        }
+
+        size_t byte_offset = record->header.offset + record->header.index * record->length;
+        if (image.size() < byte_offset + record->length)
+            image.resize(byte_offset + record->length);
+        memcpy(image.data() + byte_offset, data, record->length);
+        entries[record->slot] = record->header;
+        page_offsets[record->slot] = byte_offset;
+        offset += wal_record_size(record->length);
+    }
+    fprintf(stderr, "Replayed %llu log records; log ends at byte offset %zu (%s).\n\n", (unsigned long long)(sequence - 1), offset, reason);
+}
+
+// A file that is missing or whose header cannot be read has recovered no
+// transactions, which is the worst loss of all, so it still counts towards
+// the losses of its strategy.
+void report_nothing_recovered(std::map<std::string, std::string>& manifest, size_t record_size, torn_write_summary& summary)
+{
+    if (!manifest.empty())
+        report_recovery_point(manifest, record_size, std::vector<header_entry>(), false, summary);
+}
+
+bool verify_file(const std::string& file_name, torn_write_summary& summary)
+{
+    // Files written before manifests existed only have their record size in their name.
+    std::map<std::string, std::string> manifest;
+    size_t record_size = record_size_from_file_name(file_name);
+    if (read_manifest(file_name, manifest)) {
+        fprintf(stderr, "Written by \"%s\" on %s (%s) with seed %s.\n", manifest["command"].c_str(), manifest["host"].c_str(),
+            manifest["system"].c_str(), manifest["seed"].c_str());
+        if (!manifest["record_size"].empty())
+            record_size = std::stoul(manifest["record_size"]);
+    }
+    if (record_size_override)
+        record_size = record_size_override;
+    size_t entry_stride = manifest["entry_stride"].empty() ? sizeof(header_entry) : std::stoul(manifest["entry_stride"]);
 
-    struct header_entry { size_t offset, index, version, marker; };
-    header_entry* header_entries = (header_entry*)base;
-    for (size_t i = 0; i < 16; ++i) {
-        header_entry *header = &header_entries[i];
-        if (header->marker != std::numeric_limits<size_t>::max()) {
+    std::vector<char> image;
+    if (!read_file(file_name, image)) {
+        report_nothing_recovered(manifest, record_size, summary);
+        return false;
+    }
+    fprintf(stderr, "File is %zu bytes in size, with %zu-byte records.\n", image.size(), record_size);
+
+    std::vector<header_entry> header_entries(header_entry_count);
+    std::vector<size_t> page_offsets(header_entry_count);
+    bool every_record = false;
+    bool have_header = read_header(image, record_size, entry_stride, header_entries, page_offsets, every_record);
+
+    std::string log_name = wal_file_name(file_name);
+    std::vector<char> log;
+    if (!access(log_name.c_str(), F_OK)) {
+        if (!read_file(log_name, log)) {
+            report_nothing_recovered(manifest, record_size, summary);
+            return false;
+        }
+        fprintf(stderr, "Write-ahead log is %zu bytes in size.\n", log.size());
+        replay_log(log, image, header_entries, page_offsets);
+        have_header = true;
+    }
+    if (!have_header) {
+        report_nothing_recovered(manifest, record_size, summary);
+        return false;
+    }
+
+    bool success = true;
+    const char* base = image.data();
+    size_t file_size = image.size();
+    // With an entry for every record, only records that do not hold the version their entry gives are printed.
+    bool print_all = !every_record;
+    for (size_t i = 0; i < header_entries.size(); ++i) {
+        const header_entry *header = &header_entries[i];
+        if (header->marker != header_entry_marker) {
+            if (!print_all)
+                continue;
             fprintf(stderr, "%2zu: %zu %zu %zu 0x%016zx\n", i, header->offset, header->index, header->version, header->marker);
             fprintf(stderr, "    Not a valid header entry. Skipping.\n\n");
             continue;
         }
 
-        size_t byte_offset = header->offset + header->index * PAGE_SIZE;
+        size_t byte_offset = page_offsets[i];
         if (!i)
             fprintf(stderr, "File data expected to start at byte offset %zu.\n\n", byte_offset);
 
-        if (byte_offset > file_size - PAGE_SIZE) {
+        if (byte_offset + record_size > file_size) {
             fprintf(stderr, "%2zu: %zu %zu %zu 0x%016zx\n", i, header->offset, header->index, header->version, header->marker);
             fprintf(stderr, "    Byte offset in header entry (%zu) is large than file size!\n\n", byte_offset);
             success = false;
@@ -63,26 +580,157 @@ int main(int argc, char** argv)
         }
 
         page_entry actual_entry = *(page_entry*)(base + byte_offset);
+
+        // sector_starts holds the offset within the record at which each sector begins.
+        std::vector<sector_state> states;
+        std::vector<size_t> sector_starts;
+        for (size_t begin = 0; begin < record_size;) {
+            size_t end = std::min(record_size, ((byte_offset + begin) / sector_size + 1) * sector_size - byte_offset);
+            sector_starts.push_back(begin);
+            states.push_back(classify_sector(base + byte_offset, begin, end, header->index, header->version));
+            ++summary.sectors[states.back()];
+            begin = end;
+        }
+        size_t sector_count = states.size();
+        ++summary.records;
+
+        bool torn = false;
+        bool torn_within_atomic_block = false;
+        for (size_t s = 1; s < sector_count; ++s) {
+            if (states[s] == states[s - 1])
+                continue;
+            torn = true;
+            if ((byte_offset + sector_starts[s]) % atomic_block_size)
+                torn_within_atomic_block = true;
+        }
+
+        if (!print_all && !torn && states[0] == sector_old)
+            continue;
         fprintf(stderr, "%2zu: { 0x%016zx, 0x%016zx }\n", i, header->index, header->version);
         fprintf(stderr, "%2s  { 0x%016zx, 0x%016zx }", "", actual_entry.index, actual_entry.version);
 
-        page_entry pattern = { header->index, header->version };
-        memset_pattern16(page_buffer, &pattern, PAGE_SIZE);
-        if (memcmp(base + byte_offset, page_buffer, PAGE_SIZE)) {
-            page_entry next_pattern = { header->index, header->version + 1 };
-            memset_pattern16(page_buffer, &next_pattern, PAGE_SIZE);
-            if (!memcmp(base + byte_offset, page_buffer, PAGE_SIZE)) {
-                fprintf(stderr, " - data is a newer version than header entry. Writer was interrupted after writing data and before updating header entry?");
-            } else {
-                fprintf(stderr, " - expected { 0x%016zx, 0x%016zx }!", pattern.index, pattern.version);
-                success = false;
+        if (torn) {
+            ++summary.torn_records;
+            if (torn_within_atomic_block)
+                ++summary.torn_within_atomic_block;
+
+            fprintf(stderr, " - torn write: ");
+            for (size_t s = 0; s < sector_count; ++s) {
+                if (s && !((byte_offset + sector_starts[s]) % atomic_block_size))
+                    fputc(' ', stderr);
+                fputc(sector_state_symbols[states[s]], stderr);
             }
+            success = false;
+        } else if (states[0] == sector_new) {
+            fprintf(stderr, " - data is a newer version than header entry. Writer was interrupted after writing data and before updating header entry?");
+        } else if (states[0] != sector_old) {
+            fprintf(stderr, " - expected { 0x%016zx, 0x%016zx }, record is %s!", header->index, header->version, sector_state_names[states[0]]);
+            success = false;
         }
         fprintf(stderr, "\n\n");
     }
 
+    if (!manifest.empty())
+        report_recovery_point(manifest, record_size, header_entries, every_record, summary);
+    return success;
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option options[] = {
+        { "record-size", required_argument, nullptr, 'r' },
+        { "sector-size", required_argument, nullptr, 's' },
+        { "atomic-block-size", required_argument, nullptr, 'a' },
+        { "csv", required_argument, nullptr, 'c' },
+        { "acks", required_argument, nullptr, 'k' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    const char* csv_file_name = nullptr;
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (option) {
+        case 'r':
+            record_size_override = strtoul(optarg, nullptr, 10);
+            break;
+        case 's':
+            sector_size = strtoul(optarg, nullptr, 10);
+            break;
+        case 'a':
+            atomic_block_size = strtoul(optarg, nullptr, 10);
+            break;
+        case 'c':
+            csv_file_name = optarg;
+            break;
+        case 'k':
+            if (!read_acknowledgements(optarg))
+                return 2;
+            break;
+        default:
+            argc = 0;
+            break;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 2 || !sector_size || !atomic_block_size || (record_size_override && record_size_override < sizeof(page_entry))) {
+        fprintf(stderr, "Usage: verify [--record-size=bytes] [--sector-size=bytes] [--atomic-block-size=bytes] [--acks=file] [--csv=file] [filename...]\n");
+        return 2;
+    }
+
+    bool success = true;
+    std::map<std::string, torn_write_summary> summaries;
+    for (int i = 1; i < argc; ++i) {
+        std::string file_name = argv[i];
+        if (argc > 2)
+            fprintf(stderr, "==> %s <==\n", file_name.c_str());
+        if (!verify_file(file_name, summaries[strategy_from_file_name(file_name)]))
+            success = false;
+    }
+
+    fprintf(stderr, "Torn records by strategy (%zu-byte sectors, %zu-byte atomic blocks):\n", sector_size, atomic_block_size);
+    for (const auto& entry : summaries) {
+        const torn_write_summary& summary = entry.second;
+        fprintf(stderr, "  %s: %zu of %zu records torn, %zu within an atomic block; sectors:", entry.first.c_str(),
+            summary.torn_records, summary.records, summary.torn_within_atomic_block);
+        for (size_t s = 0; s < sector_state_count; ++s)
+            fprintf(stderr, " %s %zu", sector_state_names[s], summary.sectors[s]);
+        fputc('\n', stderr);
+        if (summary.acknowledged_files)
+            fprintf(stderr, "    lost at most %zu acknowledged transactions (%zu bytes, %.3fs) in %zu files\n", summary.max_lost_transactions,
+                summary.max_lost_bytes, summary.max_lost_seconds, summary.acknowledged_files);
+        if (summary.out_of_order_files)
+            fprintf(stderr, "    %zu files hold later transactions without earlier ones\n", summary.out_of_order_files);
+    }
+
+    // The strategy names include the record size and offset of sweeps, so the
+    // rows can be joined with main's sweep results.
+    if (csv_file_name) {
+        FILE* csv = fopen(csv_file_name, "w");
+        if (!csv) {
+            perror("fopen");
+            return 2;
+        }
+        fprintf(csv, "strategy,sector_size,atomic_block_size,records,torn_records,torn_within_atomic_block");
+        for (size_t s = 0; s < sector_state_count; ++s)
+            fprintf(csv, ",%s_sectors", sector_state_names[s]);
+        fprintf(csv, ",acknowledged_files,max_lost_transactions,max_lost_bytes,max_lost_seconds,out_of_order_files\n");
+        for (const auto& entry : summaries) {
+            const torn_write_summary& summary = entry.second;
+            fprintf(csv, "%s,%zu,%zu,%zu,%zu,%zu", entry.first.c_str(), sector_size, atomic_block_size, summary.records,
+                summary.torn_records, summary.torn_within_atomic_block);
+            for (size_t s = 0; s < sector_state_count; ++s)
+                fprintf(csv, ",%zu", summary.sectors[s]);
+            fprintf(csv, ",%zu,%zu,%zu,%.6f,%zu\n", summary.acknowledged_files, summary.max_lost_transactions, summary.max_lost_bytes,
+                summary.max_lost_seconds, summary.out_of_order_files);
+        }
+        fclose(csv);
+    }
+
     if (success)
         fprintf(stderr, "Verfication succeeded.\n");
 
-    return success;
+    // 1 means that a file failed verification, and 2 that verify itself could not run.
+    return success ? 0 : 1;
 }